@@ -1,4 +1,6 @@
 import os
+import struct
+import sys
 import torch
 import torch.nn as nn
 import torch.optim as optim
@@ -11,6 +13,35 @@ from torch.utils.data import DataLoader, TensorDataset
 device = torch.device("cuda" if torch.cuda.is_available() else "cpu")
 print(f"Using device: {device}")
 
+def export_weights(model, path, start_wavelength=400.0, end_wavelength=700.0, output_scale=1.0):
+    """Write the linear layers in the binary format src/data/spectral_net.h reads.
+
+    The header holds the magic "RSNT", the format version, the layer count, a
+    scale applied to the outputs and the wavelengths of the first and last
+    output. Each layer follows as its input and output counts, the weights
+    as outputs x inputs and the biases, all little-endian uint32 / float32.
+    """
+    layers = [m for m in model.modules() if isinstance(m, nn.Linear)]
+    if not layers:
+        layers = [getattr(model, name) for name in ('fc1', 'fc2', 'fc3', 'fc4')]
+    with open(path, 'wb') as f:
+        f.write(b'RSNT')
+        f.write(struct.pack('<IIfff', 1, len(layers), output_scale, start_wavelength, end_wavelength))
+        for layer in layers:
+            weight = layer.weight.detach().cpu().float().contiguous()
+            bias = layer.bias.detach().cpu().float().contiguous()
+            outputs, inputs = weight.shape
+            f.write(struct.pack('<II', inputs, outputs))
+            f.write(struct.pack('<%df' % weight.numel(), *weight.flatten().tolist()))
+            f.write(struct.pack('<%df' % bias.numel(), *bias.tolist()))
+    print(f"Weights exported to '{path}'")
+
+# python train_spectral.py --export spectral_model_scripted.pt converts an
+# already trained model without training again
+if len(sys.argv) == 3 and sys.argv[1] == '--export':
+    export_weights(torch.jit.load(sys.argv[2], map_location='cpu'), 'spectral_net.bin')
+    sys.exit(0)
+
 current_dir = os.path.dirname(os.path.abspath(__file__))
 train_data_file_path = os.path.join(current_dir, 'color_spectral_xyz.csv')
 # Load the CSV file
@@ -96,3 +127,6 @@ with torch.no_grad():
     scripted_model.save('spectral_model_scripted.pt')
     print("TorchScript model saved as 'spectral_model_scripted.pt'")
 
+    # Weights for the renderer's --uplift net
+    export_weights(model, 'spectral_net.bin')
+
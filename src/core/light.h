@@ -6,12 +6,18 @@
 #include "../data/interval.h"
 #include "../data/ray.h"
 #include "../data/vec3.h"
+#include "../data/triangle.h"
 #include "../core/material.h"
 
 namespace rd::core {
     class area_light : public hittable {
         public:
-            area_light(const point3& Q, const vec3& u, const vec3& v, rd::core::material* mat)
+            enum sampling_mode {
+                AREA,
+                SOLID_ANGLE
+            };
+
+            area_light(const point3& Q, const vec3& u, const vec3& v, rd::core::material* mat, sampling_mode sampling = AREA)
             : Q(Q), u(u), v(v), mat(mat)
             {
                 auto n = cross(u, v);
@@ -20,6 +26,19 @@ namespace rd::core {
                 w = n / dot(n,n);
                 area = n.length();
                 set_bounding_box();
+                set_sampling(sampling);
+            }
+
+            // Solid angle sampling only applies to rectangles, parallelograms keep area sampling
+            void set_sampling(sampling_mode mode) {
+                bool is_rectangle = std::fabs(dot(u, v)) < 1e-6 * u.length() * v.length();
+                sampling = (mode == SOLID_ANGLE && is_rectangle) ? SOLID_ANGLE : AREA;
+            }
+            sampling_mode get_sampling() const {
+                return sampling;
+            }
+            static sampling_mode sampling_from_string(const std::string& name) {
+                return name == "solid_angle" ? SOLID_ANGLE : AREA;
             }
 
             virtual void set_bounding_box() {
@@ -68,6 +87,12 @@ namespace rd::core {
                 if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
                     return 0;
 
+                if (sampling == SOLID_ANGLE) {
+                    spherical_rectangle rect(*this, origin);
+                    if (rect.valid())
+                        return 1.0 / rect.S;
+                }
+
                 auto distance_squared = rec.t * rec.t * direction.length_squared();
                 auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
 
@@ -75,9 +100,29 @@ namespace rd::core {
             }
 
             vec3 random(const point3& origin) const override {
+                if (sampling == SOLID_ANGLE) {
+                    spherical_rectangle rect(*this, origin);
+                    if (rect.valid())
+                        return rect.sample(random_double(), random_double()) - origin;
+                }
+
                 auto p = Q + (random_double() * u) + (random_double() * v);
                 return p - origin;
             }
+            light_bounds get_light_bounds() const override {
+                // One-sided emitter with a cosine falloff over the hemisphere around the normal
+                double phi = area * pi * mat->emission_power();
+                return light_bounds(bbox, normal, phi, 1.0, 0.0, false);
+            }
+            double sample_emission(hit_record& rec) const override {
+                rec.u = random_double();
+                rec.v = random_double();
+                rec.p = Q + rec.u * u + rec.v * v;
+                rec.normal = normal;
+                rec.front_face = true;
+                rec.mat = mat;
+                return 1.0 / area;
+            }
             virtual bool is_interior(double a, double b, hit_record& rec) const {
                 interval unit_interval = interval(0, 1);
                 // Given the hit point in plane coordinates, return false if it is outside the
@@ -104,6 +149,143 @@ namespace rd::core {
             vec3 normal;
             double D;
             double area;
+            sampling_mode sampling = AREA;
+
+            // Spherical rectangle seen from a shading point, after Urena et al. 2013,
+            // "An Area-Preserving Parametrization for Spherical Rectangles".
+            // Samples are uniform in the solid angle S subtended by the light.
+            struct spherical_rectangle {
+                point3 o;
+                vec3 ex, ey, ez;
+                double x0, y0, z0, x1, y1;
+                double b0, b1, k, S;
+
+                spherical_rectangle(const area_light& light, const point3& origin) : o(origin) {
+                    double u_length = light.u.length();
+                    double v_length = light.v.length();
+                    ex = light.u / u_length;
+                    ey = light.v / v_length;
+                    ez = cross(ex, ey);
+
+                    // Local frame with the rectangle on the plane z = z0 < 0
+                    vec3 d = light.Q - o;
+                    x0 = dot(d, ex);
+                    y0 = dot(d, ey);
+                    z0 = dot(d, ez);
+                    if (z0 > 0) {
+                        z0 = -z0;
+                        ez = -ez;
+                    }
+                    x1 = x0 + u_length;
+                    y1 = y0 + v_length;
+
+                    vec3 v00(x0, y0, z0), v01(x0, y1, z0), v10(x1, y0, z0), v11(x1, y1, z0);
+                    vec3 n0 = unit_vector(cross(v00, v10));
+                    vec3 n1 = unit_vector(cross(v10, v11));
+                    vec3 n2 = unit_vector(cross(v11, v01));
+                    vec3 n3 = unit_vector(cross(v01, v00));
+
+                    double g0 = std::acos(std::clamp(-dot(n0, n1), -1.0, 1.0));
+                    double g1 = std::acos(std::clamp(-dot(n1, n2), -1.0, 1.0));
+                    double g2 = std::acos(std::clamp(-dot(n2, n3), -1.0, 1.0));
+                    double g3 = std::acos(std::clamp(-dot(n3, n0), -1.0, 1.0));
+
+                    b0 = n0.z();
+                    b1 = n2.z();
+                    k = 2 * pi - g2 - g3;
+                    S = g0 + g1 - k;
+                }
+
+                // Points on or nearly on the plane of the light, or lights so small that
+                // the solid angle vanishes, are left to area sampling.
+                bool valid() const {
+                    return z0 < -1e-8 && S > 1e-6 && std::isfinite(S);
+                }
+
+                point3 sample(double u1, double u2) const {
+                    double au = u1 * S + k;
+                    double fu = (std::cos(au) * b0 - b1) / std::sin(au);
+                    double cu = std::copysign(1.0, fu) / std::sqrt(fu * fu + b0 * b0);
+                    cu = std::clamp(cu, -1.0, 1.0);
+                    double xu = -(cu * z0) / std::sqrt(std::max(1e-12, 1 - cu * cu));
+                    xu = std::clamp(xu, x0, x1);
+
+                    double d = std::sqrt(xu * xu + z0 * z0);
+                    double h0 = y0 / std::sqrt(d * d + y0 * y0);
+                    double h1 = y1 / std::sqrt(d * d + y1 * y1);
+                    double hv = h0 + u2 * (h1 - h0);
+                    double hv2 = hv * hv;
+                    double yv = (hv2 < 1 - 1e-6) ? (hv * d) / std::sqrt(1 - hv2) : y1;
+
+                    return o + xu * ex + yv * ey + z0 * ez;
+                }
+            };
+    };
+
+    // A single triangle of an emissive mesh. The mesh itself stays in the scene
+    // BVH for intersection, this only exposes the triangle to light sampling.
+    class triangle_light : public hittable {
+        public:
+            triangle_light(const triangle& tri)
+            : tri(tri), mat(tri.get_material())
+            {
+                area = tri.area();
+                bbox = tri.bounding_box();
+                bbox.pad(0.0001);
+            }
+
+            aabb bounding_box() const override { return bbox; }
+
+            bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+                return tri.hit(r, ray_t, rec);
+            }
+
+            double pdf_value(const point3& origin, const vec3& direction) const override {
+                hit_record rec;
+                if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+                    return 0;
+
+                auto distance_squared = rec.t * rec.t * direction.length_squared();
+                auto cosine = std::fabs(dot(direction, tri.get_face_normal()) / direction.length());
+                if (cosine < 1e-8)
+                    return 0;
+
+                return distance_squared / (cosine * area);
+            }
+
+            vec3 random(const point3& origin) const override {
+                // Uniform sampling of the triangle area
+                double su0 = std::sqrt(random_double());
+                double b0 = 1 - su0;
+                double b1 = random_double() * su0;
+                auto p = b0 * tri.vertex(0) + b1 * tri.vertex(1) + (1 - b0 - b1) * tri.vertex(2);
+                return p - origin;
+            }
+
+            light_bounds get_light_bounds() const override {
+                // Emissive materials radiate from both faces of the triangle
+                double phi = 2 * area * pi * mat->emission_power();
+                return light_bounds(bbox, tri.get_face_normal(), phi, 1.0, 0.0, true);
+            }
+            double sample_emission(hit_record& rec) const override {
+                double su0 = std::sqrt(random_double());
+                double b0 = 1 - su0;
+                double b1 = random_double() * su0;
+                rec.p = b0 * tri.vertex(0) + b1 * tri.vertex(1) + (1 - b0 - b1) * tri.vertex(2);
+                rec.u = b1;
+                rec.v = 1 - b0 - b1;
+                // Either face emits, each is picked half of the time
+                bool back = random_double() < 0.5;
+                rec.normal = back ? -tri.get_face_normal() : tri.get_face_normal();
+                rec.front_face = !back;
+                rec.mat = mat;
+                return 0.5 / area;
+            }
+        private:
+            triangle tri;
+            rd::core::material * mat;
+            aabb bbox;
+            double area;
     };
 }
 
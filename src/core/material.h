@@ -7,13 +7,22 @@
 #include "../data/onb.h"
 #include "../data/spectrum.h"
 #include "../image/image_spd.h"
+#include "microfacet.h"
 class hit_record;
+// Lobe a pdf_ptr sample belongs to. Only diffuse lobes gather caustics, take
+// part in path guiding and get split; glossy ones count as specular bounces.
+enum scatter_lobe {
+    LOBE_DIFFUSE = 0,
+    LOBE_GLOSSY_REFLECTION,
+    LOBE_GLOSSY_TRANSMISSION
+};
 class scatter_record {
   public:
     spectrum attenuation;
-    pdf * pdf_ptr;
-    bool skip_pdf;
+    pdf * pdf_ptr = nullptr;
+    bool skip_pdf = false;
     ray skip_pdf_ray;
+    int lobe = LOBE_DIFFUSE;
 };
 namespace rd::core {
     class material {
@@ -26,12 +35,25 @@ namespace rd::core {
             return false;
         }
         virtual double scattering_pdf(
-            const ray& r_in, const hit_record& rec, const ray& scattered
+            const ray& r_in, const hit_record& rec, const ray& scattered, int lobe = LOBE_DIFFUSE
         ) const {
             return 0;
         }
         virtual spectrum emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const {
-            return spectrum(color(0,0,0));
+            return spectrum();
+        }
+        // Average emitted radiance, used to weight emitters when sampling lights
+        virtual double emission_power() const {
+            return 0.0;
+        }
+        // Emitted radiance falls off as cos^n about the normal, 0 for a
+        // Lambertian emitter
+        virtual double emission_exponent() const {
+            return 0.0;
+        }
+        // Reflectance at the first hit, written to the denoiser feature buffer
+        virtual spectrum get_albedo() const {
+            return spectrum::uniform(1.0f);
         }
         virtual bool is_visible() const {
             return visible;
@@ -46,7 +68,7 @@ namespace rd::core {
             cast_shadow = v;
         }
         virtual spectrum fast_ray_color(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const {
-            return spectrum(color(0.5,0.5,0.5));
+            return spectrum::uniform(0.5f);
         }
         virtual void set_fast_light_color(spectrum c){
             fast_light_color = c;
@@ -74,14 +96,22 @@ namespace rd::core {
             // Instead of scattering, we emit the constant color
             return albedo;
         }
+        spectrum get_albedo() const override {
+            return albedo;
+        }
 
     private:
         spectrum albedo;
     };
     class light : public material {
     public:
+        // Spreads at or below zero, a collimated light in UsdLux, are held at
+        // MIN_SPREAD so the falloff exponent 1 / spread stays finite
+        static constexpr double MIN_SPREAD = 1e-3;
+
         light(const spectrum& light_color, double light_intensity, ImageSPD * texture = nullptr, double light_spread = 1.0) 
-        : light_color(light_color), light_intensity(light_intensity), texture(texture), light_spread(light_spread) {
+        : light_color(light_color), light_intensity(light_intensity), texture(texture),
+          light_spread(std::isnan(light_spread) ? 1.0 : std::max(light_spread, MIN_SPREAD)) {
             set_visible(true), set_cast_shadow(false);
         }
 
@@ -92,7 +122,7 @@ namespace rd::core {
 
         spectrum emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const override {
             if (!rec.front_face)
-                return spectrum(color(0,0,0));
+                return spectrum();
             if (texture) {
                 // Calculate the angle between the light normal and the ray direction
                 double cos_angle = dot(unit_vector(rec.normal), unit_vector(-r_in.direction()));
@@ -101,7 +131,7 @@ namespace rd::core {
                 double intensity_factor = 1.0;
                 if (light_spread < 1.0) {
                     // Use a more appropriate falloff function
-                    intensity_factor = std::pow(std::max(0.0, cos_angle), 1.0 / light_spread);
+                    intensity_factor = fast_pow(float(std::max(0.0, cos_angle)), float(1.0 / light_spread));
                 }
                 
                 // Apply the intensity factor to the light intensity
@@ -113,6 +143,13 @@ namespace rd::core {
         void set_emission(const spectrum& c){
             light_color = c;
         }
+        double emission_power() const override {
+            return light_color.average() * light_intensity * mult;
+        }
+        // Matches the falloff emitted applies, which only textured lights have
+        double emission_exponent() const override {
+            return texture && light_spread < 1.0 ? 1.0 / light_spread : 0.0;
+        }
 
     private:
         spectrum light_color;
@@ -134,12 +171,15 @@ namespace rd::core {
             srec.attenuation = albedo;
             return (dot(srec.skip_pdf_ray.direction(), rec.normal) > 0);
         }
-        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered)
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered, int lobe)
         const override {
             // For perfect reflection, pdf is infinite at the reflection angle, 0 elsewhere
             // In practice, we return 1 for numerical stability
             return 1.0;
         }
+        spectrum get_albedo() const override {
+            return albedo;
+        }
 
     private:
         spectrum albedo;
@@ -147,11 +187,11 @@ namespace rd::core {
     };
     class dielectric : public material {
     public:
-        dielectric(double refraction_index, double fuzz = 0.0) : refraction_index(refraction_index), fuzz(fuzz < 1 ? fuzz : 1) {}
+        dielectric(double refraction_index, double fuzz = 0.0) : refraction_index(refraction_index), fuzz(fuzz < 1 ? fuzz : 1), tint(color(1.0, 1.0, 0.9)) {}
 
         bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
         const override {
-            srec.attenuation = spectrum(color(1.0, 1.0, 0.9));
+            srec.attenuation = tint;
             double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
             vec3 unit_direction = unit_vector(r_in.direction());
@@ -171,7 +211,7 @@ namespace rd::core {
             srec.pdf_ptr = nullptr;
             return true;
         }
-        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered)
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered, int lobe)
         const override {
             return 1.0;
         }
@@ -181,11 +221,14 @@ namespace rd::core {
         // the refractive index of the enclosing media
         double refraction_index;
         double fuzz;
+        // Uplifted once, scatter runs for every glass hit
+        spectrum tint;
         static double reflectance(double cosine, double refraction_index) {
             // Use Schlick's approximation for reflectance.
             auto r0 = (1 - refraction_index) / (1 + refraction_index);
             r0 = r0*r0;
-            return r0 + (1-r0)*std::pow((1 - cosine),5);
+            double m = 1 - cosine;
+            return r0 + (1-r0)*(m*m)*(m*m)*m;
         }
     };
 
@@ -206,6 +249,8 @@ namespace rd::core {
                 std::cout << "specular_color: " << specular_color << std::endl;
                 std::cout << "transmission_color: " << transmission_color << std::endl;
                 std::cout << "emission_color: " << emission_color << std::endl;
+                // Builds the GGX albedo table now rather than on the first glossy hit
+                ggx::albedo(1.0, 1.0);
             }
         spectrum fast_ray_color(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const override {
             // Calculate the dot product of the normal and the up vector
@@ -220,7 +265,6 @@ namespace rd::core {
         bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
             vec3 unit_direction = unit_vector(r_in.direction());
             vec3 reflected = reflect(unit_direction, rec.normal);
-            spectrum weighted_base_color = base_color * base_weight;
 
             // Calculate the total weight
             double total_weight = base_weight + specular_weight + transmission_weight;
@@ -234,44 +278,53 @@ namespace rd::core {
             double p = random_double();
             if (p < norm_base_weight) {
                 // Diffuse scattering
-                onb uvw;
-                uvw.build_from_w(rec.normal);
-                vec3 scatter_direction = uvw.transform(random_cosine_direction());
-                srec.skip_pdf_ray = ray(rec.p, scatter_direction, r_in.get_depth() + 1);
                 srec.attenuation = base_color * (1.0 - base_metalness) * norm_base_weight;
-                srec.skip_pdf = true;
+                srec.pdf_ptr = new cosine_pdf(rec.normal);
+                srec.skip_pdf = false;
 
             } else {
-                double computed_ior = specular_ior + (r_in.wavelength - 550.0) / 300.0 / 8.0;
-                double refraction_ratio = rec.front_face ? (1.0 / computed_ior) : computed_ior;
+                double refraction_ratio = relative_ior(r_in, rec);
                 double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
                 double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
                 bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+                bool reflect_lobe = cannot_refract || reflectance(cos_theta, refraction_ratio) > p;
+                double alpha = specular_roughness * specular_roughness;
 
-                if (cannot_refract || reflectance(cos_theta, refraction_ratio) > p){
-                    // Specular reflection
-                    vec3 scatter_direction = reflected + specular_roughness * random_in_unit_sphere();
-                    scatter_direction = unit_vector(scatter_direction);
-                    srec.skip_pdf_ray = ray(rec.p, scatter_direction, r_in.get_depth() + 1);
+                if (reflect_lobe)
                     srec.attenuation = specular_color * specular_weight;
-                    srec.skip_pdf = true;
-
-                } else {
-                    // Transmission (refraction)
-                    
-                    vec3 direction = refract(unit_direction, rec.normal, refraction_ratio);
+                else
+                    srec.attenuation = transmission_color * transmission_weight;
 
+                if (alpha < MIN_GGX_ALPHA) {
+                    // Smooth surfaces keep the delta lobes
+                    vec3 direction = reflect_lobe ? reflected : refract(unit_direction, rec.normal, refraction_ratio);
                     srec.skip_pdf_ray = ray(rec.p, direction, r_in.get_depth() + 1);
-                    srec.attenuation = transmission_color * transmission_weight;
                     srec.skip_pdf = true;
+                } else if (reflect_lobe) {
+                    srec.pdf_ptr = new ggx_reflection_pdf(rec.normal, -unit_direction, alpha);
+                    srec.lobe = LOBE_GLOSSY_REFLECTION;
+                    srec.skip_pdf = false;
+                } else {
+                    srec.pdf_ptr = new ggx_transmission_pdf(rec.normal, -unit_direction, alpha, 1.0 / refraction_ratio);
+                    srec.lobe = LOBE_GLOSSY_TRANSMISSION;
+                    srec.skip_pdf = false;
                 }
             }
 
             return true;
         }
-        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
-            if (transmission_weight > 0) {
-                return 1.0;  // Perfect transmission
+        // Fresnel is not part of the glossy lobes, it decides between them in scatter
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered, int lobe) const override {
+            if (lobe != LOBE_DIFFUSE) {
+                vec3 wo = -unit_vector(r_in.direction());
+                vec3 wi = unit_vector(scattered.direction());
+                onb uvw(rec.normal);
+                vec3 local_wo = ggx_reflection_pdf::to_local(uvw, wo);
+                vec3 local_wi = ggx_reflection_pdf::to_local(uvw, wi);
+                double alpha = specular_roughness * specular_roughness;
+                if (lobe == LOBE_GLOSSY_REFLECTION)
+                    return ggx::eval_reflection(local_wo, local_wi, alpha);
+                return ggx::eval_transmission(local_wo, local_wi, alpha, 1.0 / relative_ior(r_in, rec));
             }
             auto cosine = dot(rec.normal, unit_vector(scattered.direction()));
             return cosine < 0 ? 0 : cosine / pi;
@@ -279,6 +332,12 @@ namespace rd::core {
         spectrum emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const override {
             return emission_color * emission_luminance;
         }
+        double emission_power() const override {
+            return emission_color.average() * emission_luminance;
+        }
+        spectrum get_albedo() const override {
+            return base_color * base_weight;
+        }
 
         double gamma = 1.0;
         double offset = 0.0;
@@ -296,13 +355,23 @@ namespace rd::core {
         spectrum transmission_color;
         double emission_luminance;
         spectrum emission_color;
+        // Below this GGX alpha the glossy lobes are treated as perfectly smooth
+        static constexpr double MIN_GGX_ALPHA = 1e-3;
+
         static double reflectance(double cosine, double ref_idx) {
             // Use Schlick's approximation for reflectance.
             auto r0 = (1 - ref_idx) / (1 + ref_idx);
             r0 = r0 * r0;
-            return r0 + (1 - r0) * pow((1 - cosine), 5);
+            double m = 1 - cosine;
+            return r0 + (1 - r0) * (m * m) * (m * m) * m;
         }
-        
+        // Index of refraction on the incoming side over the one on the far side,
+        // with a little dispersion
+        double relative_ior(const ray& r_in, const hit_record& rec) const {
+            double computed_ior = specular_ior + (r_in.wavelength - 550.0) / 300.0 / 8.0;
+            return rec.front_face ? (1.0 / computed_ior) : computed_ior;
+        }
+
     };
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,207 @@
+#ifndef MICROFACET_H
+#define MICROFACET_H
+
+#include "../data/pdf.h"
+#include "../data/onb.h"
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+namespace rd::core {
+
+    // GGX / Trowbridge-Reitz microfacet model with Smith height-correlated
+    // masking. Directions are in a local frame with the normal along z, wo
+    // points towards the viewer and wi along the scattered ray.
+    class ggx {
+    public:
+        static double D(const vec3& h, double alpha) {
+            if (h.z() <= 0)
+                return 0.0;
+            double cos2 = h.z() * h.z();
+            double a2 = alpha * alpha;
+            double d = cos2 * (a2 - 1) + 1;
+            return a2 / (pi * d * d);
+        }
+        static double lambda(const vec3& w, double alpha) {
+            double cos2 = w.z() * w.z();
+            if (cos2 <= 0)
+                return 0.0;
+            double tan2 = (1 - cos2) / cos2;
+            return (std::sqrt(1 + alpha * alpha * tan2) - 1) / 2;
+        }
+        static double G1(const vec3& w, double alpha) {
+            return 1.0 / (1.0 + lambda(w, alpha));
+        }
+        static double G2(const vec3& wo, const vec3& wi, double alpha) {
+            return 1.0 / (1.0 + lambda(wo, alpha) + lambda(wi, alpha));
+        }
+
+        // Microfacet normal sampled from the normals visible from wo (Heitz 2018,
+        // "Sampling the GGX Distribution of Visible Normals")
+        static vec3 sample_vndf(const vec3& wo, double alpha, double u1, double u2) {
+            vec3 vh = unit_vector(vec3(alpha * wo.x(), alpha * wo.y(), wo.z()));
+            double length2 = vh.x() * vh.x() + vh.y() * vh.y();
+            vec3 t1 = length2 > 0 ? vec3(-vh.y(), vh.x(), 0) / std::sqrt(length2) : vec3(1, 0, 0);
+            vec3 t2 = cross(vh, t1);
+            double r = std::sqrt(u1);
+            double phi = 2 * pi * u2;
+            double p1 = r * std::cos(phi);
+            double p2 = r * std::sin(phi);
+            double s = 0.5 * (1.0 + vh.z());
+            p2 = (1.0 - s) * std::sqrt(1.0 - p1 * p1) + s * p2;
+            vec3 nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.0, 1.0 - p1 * p1 - p2 * p2)) * vh;
+            return unit_vector(vec3(alpha * nh.x(), alpha * nh.y(), std::max(1e-6, nh.z())));
+        }
+
+        // Reflection lobe times the cosine of wi, without Fresnel, which is
+        // applied by choosing between reflection and transmission. Energy lost
+        // to multiple scattering between microfacets is added back by dividing
+        // by the directional albedo (Turquin 2019 with a white Fresnel term).
+        static double eval_reflection(const vec3& wo, const vec3& wi, double alpha) {
+            if (wo.z() <= 0 || wi.z() <= 0)
+                return 0.0;
+            vec3 h = unit_vector(wo + wi);
+            return D(h, alpha) * G2(wo, wi, alpha) / (4 * wo.z()) / albedo(wo.z(), alpha);
+        }
+        static double pdf_reflection(const vec3& wo, const vec3& wi, double alpha) {
+            if (wo.z() <= 0 || wi.z() <= 0)
+                return 0.0;
+            vec3 h = unit_vector(wo + wi);
+            return G1(wo, alpha) * D(h, alpha) / (4 * wo.z());
+        }
+
+        // Transmission lobe times the cosine of wi (Walter et al. 2007), eta is
+        // the index of refraction on the wi side over the one on the wo side
+        static double eval_transmission(const vec3& wo, const vec3& wi, double alpha, double eta) {
+            double wo_h, wi_h, denominator;
+            vec3 h;
+            if (!transmission_half_vector(wo, wi, eta, h, wo_h, wi_h, denominator))
+                return 0.0;
+            return std::fabs(wi_h) * wo_h * eta * eta * G2(wo, wi, alpha) * D(h, alpha) / (wo.z() * denominator * denominator);
+        }
+        static double pdf_transmission(const vec3& wo, const vec3& wi, double alpha, double eta) {
+            double wo_h, wi_h, denominator;
+            vec3 h;
+            if (!transmission_half_vector(wo, wi, eta, h, wo_h, wi_h, denominator))
+                return 0.0;
+            double jacobian = eta * eta * std::fabs(wi_h) / (denominator * denominator);
+            return G1(wo, alpha) * wo_h * D(h, alpha) / wo.z() * jacobian;
+        }
+
+        // Directional albedo of the reflection lobe without Fresnel, from a
+        // table computed once on first use
+        static double albedo(double cos_theta, double alpha) {
+            static const std::array<float, ALBEDO_SIZE * ALBEDO_SIZE> table = build_albedo_table();
+            double x = std::clamp(cos_theta, 0.0, 1.0) * (ALBEDO_SIZE - 1);
+            double y = std::clamp(alpha, 0.0, 1.0) * (ALBEDO_SIZE - 1);
+            int x0 = std::min(int(x), ALBEDO_SIZE - 2);
+            int y0 = std::min(int(y), ALBEDO_SIZE - 2);
+            double fx = x - x0, fy = y - y0;
+            double a = table[y0 * ALBEDO_SIZE + x0] * (1 - fx) + table[y0 * ALBEDO_SIZE + x0 + 1] * fx;
+            double b = table[(y0 + 1) * ALBEDO_SIZE + x0] * (1 - fx) + table[(y0 + 1) * ALBEDO_SIZE + x0 + 1] * fx;
+            return std::max(a * (1 - fy) + b * fy, 1e-3);
+        }
+
+    private:
+        static constexpr int ALBEDO_SIZE = 32;
+
+        static bool transmission_half_vector(const vec3& wo, const vec3& wi, double eta, vec3& h, double& wo_h, double& wi_h, double& denominator) {
+            if (wo.z() <= 0 || wi.z() >= 0)
+                return false;
+            h = -(wo + eta * wi);
+            if (h.length_squared() <= 0)
+                return false;
+            h = unit_vector(h);
+            if (h.z() < 0)
+                h = -h;
+            wo_h = dot(wo, h);
+            wi_h = dot(wi, h);
+            denominator = wo_h + eta * wi_h;
+            return wo_h > 0 && wi_h < 0 && std::fabs(denominator) > 1e-8;
+        }
+
+        static std::array<float, ALBEDO_SIZE * ALBEDO_SIZE> build_albedo_table() {
+            // Stratified estimate of the average G2 / G1 weight of VNDF samples
+            const int STRATA = 32;
+            std::array<float, ALBEDO_SIZE * ALBEDO_SIZE> table;
+            for (int j = 0; j < ALBEDO_SIZE; ++j) {
+                double alpha = std::max(double(j) / (ALBEDO_SIZE - 1), 1e-3);
+                for (int i = 0; i < ALBEDO_SIZE; ++i) {
+                    double cos_theta = std::max(double(i) / (ALBEDO_SIZE - 1), 1e-3);
+                    vec3 wo(std::sqrt(1 - cos_theta * cos_theta), 0, cos_theta);
+                    double sum = 0.0;
+                    for (int sy = 0; sy < STRATA; ++sy) {
+                        for (int sx = 0; sx < STRATA; ++sx) {
+                            vec3 h = sample_vndf(wo, alpha, (sx + 0.5) / STRATA, (sy + 0.5) / STRATA);
+                            vec3 wi = 2 * dot(wo, h) * h - wo;
+                            if (wi.z() > 0)
+                                sum += G2(wo, wi, alpha) / G1(wo, alpha);
+                        }
+                    }
+                    table[j * ALBEDO_SIZE + i] = float(sum / (STRATA * STRATA));
+                }
+            }
+            return table;
+        }
+    };
+
+    // Sampling densities of the GGX lobes for the pdf path, so they can be
+    // mixed with light sampling
+    class ggx_reflection_pdf : public pdf {
+    public:
+        ggx_reflection_pdf(const vec3& normal, const vec3& wo, double alpha) : alpha(alpha) {
+            uvw.build_from_w(normal);
+            local_wo = to_local(uvw, unit_vector(wo));
+        }
+
+        double value(const vec3& direction) const override {
+            return ggx::pdf_reflection(local_wo, to_local(uvw, unit_vector(direction)), alpha);
+        }
+
+        vec3 generate() const override {
+            vec3 h = ggx::sample_vndf(local_wo, alpha, random_double(), random_double());
+            return uvw.transform(2 * dot(local_wo, h) * h - local_wo);
+        }
+
+        static vec3 to_local(const onb& frame, const vec3& v) {
+            return vec3(dot(v, frame.u()), dot(v, frame.v()), dot(v, frame.w()));
+        }
+
+    private:
+        onb uvw;
+        vec3 local_wo;
+        double alpha;
+    };
+
+    class ggx_transmission_pdf : public pdf {
+    public:
+        ggx_transmission_pdf(const vec3& normal, const vec3& wo, double alpha, double eta) : alpha(alpha), eta(eta) {
+            uvw.build_from_w(normal);
+            local_wo = ggx_reflection_pdf::to_local(uvw, unit_vector(wo));
+        }
+
+        double value(const vec3& direction) const override {
+            return ggx::pdf_transmission(local_wo, ggx_reflection_pdf::to_local(uvw, unit_vector(direction)), alpha, eta);
+        }
+
+        vec3 generate() const override {
+            vec3 h = ggx::sample_vndf(local_wo, alpha, random_double(), random_double());
+            double cos_o = dot(local_wo, h);
+            double sin2_t = (1 - cos_o * cos_o) / (eta * eta);
+            // Total internal reflection at this microfacet, the lobe has no density there
+            if (sin2_t >= 1)
+                return uvw.transform(2 * cos_o * h - local_wo);
+            double cos_t = std::sqrt(1 - sin2_t);
+            vec3 wi = -local_wo / eta + (cos_o / eta - cos_t) * h;
+            return uvw.transform(wi);
+        }
+
+    private:
+        onb uvw;
+        vec3 local_wo;
+        double alpha;
+        double eta;
+    };
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "ray.h"
 #include "interval.h"
 #include "aabb.h"
+#include "light_bounds.h"
 
 namespace rd::core {
   class material;
@@ -37,6 +38,18 @@ class hittable {
     virtual vec3 random(const point3& origin) const {
         return vec3(1,0,0);
     }
+
+    // Emitters report their power and emission cone so they can be placed in the light BVH.
+    virtual light_bounds get_light_bounds() const {
+        return light_bounds();
+    }
+
+    // Picks a point on an emitter to start a light path from. Fills the position,
+    // the normal of the emitting side and the material of rec and returns the
+    // density of the point with respect to area, or 0 for non-emitters.
+    virtual double sample_emission(hit_record& rec) const {
+        return 0.0;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+#ifndef LIGHT_BOUNDS_H
+#define LIGHT_BOUNDS_H
+
+#include <algorithm>
+#include "vec3.h"
+#include "ray.h"
+#include "interval.h"
+#include "aabb.h"
+
+// Spatial and directional bounds of one or more emitters, used to build and
+// traverse the light BVH. The emission directions are bounded by a cone around
+// w with half-angle theta_o, and light may fall off over a further theta_e.
+class light_bounds {
+  public:
+    aabb bounds;
+    vec3 w = vec3(0, 0, 1);
+    double phi = 0.0;
+    double cos_theta_o = 1.0;
+    double cos_theta_e = 0.0;
+    bool two_sided = false;
+
+    light_bounds() {}
+    light_bounds(const aabb& bounds, const vec3& w, double phi, double cos_theta_o, double cos_theta_e, bool two_sided)
+      : bounds(bounds), w(unit_vector(w)), phi(phi), cos_theta_o(cos_theta_o), cos_theta_e(cos_theta_e), two_sided(two_sided) {}
+
+    // Union of two light bounds
+    light_bounds(const light_bounds& a, const light_bounds& b) {
+        if (a.phi == 0) { *this = b; return; }
+        if (b.phi == 0) { *this = a; return; }
+
+        bounds = aabb(a.bounds, b.bounds);
+        phi = a.phi + b.phi;
+        cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+        two_sided = a.two_sided || b.two_sided;
+        union_cone(a.w, a.cos_theta_o, b.w, b.cos_theta_o);
+    }
+
+    bool is_empty() const { return phi == 0; }
+    point3 centroid() const { return bounds.centroid(); }
+
+    // Conservative estimate of the light arriving at p from everything inside
+    // these bounds. Pass a zero normal when the receiving surface is unknown.
+    double importance(const point3& p, const vec3& n) const {
+        if (phi == 0) return 0;
+
+        point3 pc = bounds.centroid();
+        double d2 = (p - pc).length_squared();
+        vec3 wi = d2 > 0 ? (p - pc) / std::sqrt(d2) : w;
+        d2 = std::max(d2, bounds.size().length() / 2);
+
+        double cos_theta_w = dot(w, wi);
+        if (two_sided) cos_theta_w = std::fabs(cos_theta_w);
+        double sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+
+        // Angle subtended by the bounds as seen from p
+        double cos_theta_b = subtended_cos(p);
+        double sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+        // Minimum angle between the emission cone and the direction to p
+        double sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+        double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        double sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        double cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= cos_theta_e) return 0;
+
+        double result = phi * cos_theta_p / d2;
+
+        if (n.length_squared() > 0) {
+            double cos_theta_i = std::fabs(dot(wi, n));
+            double sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+            result *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+        }
+        return std::max(result, 0.0);
+    }
+
+  private:
+    static double safe_sqrt(double x) { return std::sqrt(std::max(0.0, x)); }
+    static double safe_acos(double x) { return std::acos(std::clamp(x, -1.0, 1.0)); }
+
+    // cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+    static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        if (cos_a > cos_b) return 1;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+    static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        if (cos_a > cos_b) return 0;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    double subtended_cos(const point3& p) const {
+        point3 center = bounds.centroid();
+        double radius2 = (bounds.max() - center).length_squared();
+        double d2 = (p - center).length_squared();
+        if (d2 < radius2) return -1;
+        return safe_sqrt(1 - radius2 / d2);
+    }
+
+    void union_cone(const vec3& wa, double cos_a, const vec3& wb, double cos_b) {
+        double theta_a = safe_acos(cos_a);
+        double theta_b = safe_acos(cos_b);
+        double theta_d = safe_acos(dot(wa, wb));
+
+        // One cone already contains the other
+        if (std::min(theta_d + theta_b, pi) <= theta_a) { w = wa; cos_theta_o = cos_a; return; }
+        if (std::min(theta_d + theta_a, pi) <= theta_b) { w = wb; cos_theta_o = cos_b; return; }
+
+        double theta_o = (theta_a + theta_d + theta_b) / 2;
+        vec3 axis = cross(wa, wb);
+        if (theta_o >= pi || axis.length_squared() == 0) {
+            w = wa;
+            cos_theta_o = -1;
+            return;
+        }
+
+        // Rotate wa towards wb by theta_r around their common normal
+        double theta_r = theta_o - theta_a;
+        axis = unit_vector(axis);
+        w = wa * std::cos(theta_r) + cross(axis, wa) * std::sin(theta_r) + axis * dot(axis, wa) * (1 - std::cos(theta_r));
+        w = unit_vector(w);
+        cos_theta_o = std::cos(theta_o);
+    }
+};
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "light_bounds.h"
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+
+// Bounding volume hierarchy over the emitters of a scene. A light is chosen by
+// walking down from the root and picking each child in proportion to its
+// importance at the shading point, so both sampling and the pdf lookup for MIS
+// cost O(log n) instead of touching every light.
+class light_bvh : public hittable {
+  public:
+    light_bvh(hittable_list * list) {
+        build(list);
+    }
+
+    void build(hittable_list * list) {
+        lights.clear();
+        nodes.clear();
+        trails.clear();
+        light_index.clear();
+
+        std::vector<build_item> items;
+        for (hittable* object : *list->objects) {
+            light_bounds bounds = object->get_light_bounds();
+            // Lights that emit nothing are never sampled
+            if (bounds.is_empty())
+                continue;
+            bounds.bounds.pad(0.0001);
+            light_index[object] = int(lights.size());
+            items.push_back({int(lights.size()), bounds});
+            lights.push_back(object);
+        }
+        trails.resize(lights.size(), 0);
+        if (!items.empty())
+            build_recursive(items, 0, items.size(), 0, 0);
+
+        std::cout << "Light BVH: " << lights.size() << " lights, " << nodes.size() << " nodes" << std::endl;
+    }
+
+    bool empty() const { return nodes.empty(); }
+    int size() const { return int(lights.size()); }
+
+    // Pick a light for the shading point p. Returns -1 when there is nothing to sample.
+    int sample_light(const point3& p, double u, double& pmf) const {
+        pmf = 0;
+        if (nodes.empty())
+            return -1;
+
+        pmf = 1;
+        int node = 0;
+        while (!nodes[node].is_leaf) {
+            double p_left = left_probability(node, p);
+            if (u < p_left) {
+                u = std::min(u / p_left, one_minus_epsilon);
+                pmf *= p_left;
+                node = node + 1;
+            } else {
+                u = std::min((u - p_left) / (1 - p_left), one_minus_epsilon);
+                pmf *= 1 - p_left;
+                node = nodes[node].index;
+            }
+        }
+        return nodes[node].index;
+    }
+
+    // Probability that sample_light picks the given light from p, found by
+    // replaying the light's path from the root.
+    double pmf(const hittable* light, const point3& p) const {
+        auto it = light_index.find(light);
+        if (it == light_index.end())
+            return 0;
+        return pmf(it->second, p);
+    }
+
+    hittable* get_light(int index) const { return lights[index]; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty())
+            return false;
+
+        bool hit_anything = false;
+        int stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            int index = stack[--stack_size];
+            const node_type& node = nodes[index];
+            if (!node.bounds.bounds.hit(r, ray_t))
+                continue;
+            if (node.is_leaf) {
+                if (lights[node.index]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            } else {
+                stack[stack_size++] = node.index;
+                stack[stack_size++] = index + 1;
+            }
+        }
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override {
+        return nodes.empty() ? aabb() : nodes[0].bounds.bounds;
+    }
+
+    // Solid angle density of sampling direction from origin. Only lights whose
+    // bounds the direction passes through are visited.
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        if (nodes.empty())
+            return 0;
+
+        ray r(origin, direction);
+        interval ray_t(0.001, infinity);
+        double sum = 0.0;
+        int stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            int index = stack[--stack_size];
+            const node_type& node = nodes[index];
+            if (!node.bounds.bounds.hit(r, ray_t))
+                continue;
+            if (node.is_leaf) {
+                double light_pdf = lights[node.index]->pdf_value(origin, direction);
+                if (light_pdf > 0)
+                    sum += pmf(node.index, origin) * light_pdf;
+            } else {
+                stack[stack_size++] = node.index;
+                stack[stack_size++] = index + 1;
+            }
+        }
+        return sum;
+    }
+
+    vec3 random(const point3& origin) const override {
+        double light_pmf;
+        int light = sample_light(origin, random_double(), light_pmf);
+        if (light < 0)
+            return vec3(1,0,0);
+        return lights[light]->random(origin);
+    }
+
+  private:
+    static constexpr double one_minus_epsilon = 0x1.fffffffffffffp-1;
+    static constexpr int NUM_BINS = 12;
+    // Below this depth splits are forced to the median so bit trails fit in 64 bits
+    static constexpr int MAX_SAH_DEPTH = 32;
+
+    struct node_type {
+        light_bounds bounds;
+        // Light index for leaves, index of the second child for interior nodes.
+        // The first child always directly follows its parent.
+        int index = -1;
+        bool is_leaf = false;
+    };
+    struct build_item {
+        int light;
+        light_bounds bounds;
+    };
+
+    std::vector<hittable*> lights;
+    std::vector<node_type> nodes;
+    // Bit i of a trail selects the child taken at depth i on the way to the light
+    std::vector<uint64_t> trails;
+    std::unordered_map<const hittable*, int> light_index;
+
+    double left_probability(int node, const point3& p) const {
+        double left = nodes[node + 1].bounds.importance(p, vec3(0,0,0));
+        double right = nodes[nodes[node].index].bounds.importance(p, vec3(0,0,0));
+        if (left + right <= 0)
+            return 0.5;
+        return left / (left + right);
+    }
+
+    double pmf(int light, const point3& p) const {
+        uint64_t trail = trails[light];
+        double result = 1.0;
+        int node = 0;
+        while (!nodes[node].is_leaf) {
+            double p_left = left_probability(node, p);
+            if (trail & 1) {
+                result *= 1 - p_left;
+                node = nodes[node].index;
+            } else {
+                result *= p_left;
+                node = node + 1;
+            }
+            trail >>= 1;
+        }
+        return result;
+    }
+
+    // Orientation-aware surface area heuristic from Conty Estevez and Kulla (2018)
+    static double split_cost(const light_bounds& b, const aabb& parent, int axis) {
+        double theta_o = std::acos(std::clamp(b.cos_theta_o, -1.0, 1.0));
+        double theta_e = std::acos(std::clamp(b.cos_theta_e, -1.0, 1.0));
+        double theta_w = std::min(theta_o + theta_e, pi);
+        double sin_theta_o = std::sin(theta_o);
+        double m_omega = 2 * pi * (1 - b.cos_theta_o) +
+                         pi / 2 * (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w) -
+                                   2 * theta_o * sin_theta_o + b.cos_theta_o);
+        vec3 extent = parent.size();
+        double max_extent = std::max({extent.x(), extent.y(), extent.z()});
+        double kr = extent[axis] > 0 ? max_extent / extent[axis] : 1.0;
+        return b.phi * m_omega * kr * b.bounds.surface_area();
+    }
+
+    int build_recursive(std::vector<build_item>& items, size_t start, size_t end, uint64_t trail, int depth) {
+        int node_index = int(nodes.size());
+        nodes.emplace_back();
+
+        if (end - start == 1) {
+            nodes[node_index].bounds = items[start].bounds;
+            nodes[node_index].index = items[start].light;
+            nodes[node_index].is_leaf = true;
+            trails[items[start].light] = trail;
+            return node_index;
+        }
+
+        aabb bounds;
+        aabb centroid_bounds;
+        for (size_t i = start; i < end; ++i) {
+            bounds = aabb(bounds, items[i].bounds.bounds);
+            centroid_bounds = aabb(centroid_bounds, items[i].bounds.centroid());
+        }
+
+        size_t mid = start;
+        double best_cost = infinity;
+        int best_axis = -1;
+        int best_bin = -1;
+        if (depth < MAX_SAH_DEPTH) {
+            for (int axis = 0; axis < 3; ++axis) {
+                const interval& axis_interval = centroid_bounds.axis_interval(axis);
+                if (axis_interval.size() <= 0)
+                    continue;
+
+                std::array<light_bounds, NUM_BINS> bins;
+                for (size_t i = start; i < end; ++i) {
+                    int bin = bin_index(items[i].bounds.centroid()[axis], axis_interval);
+                    bins[bin] = light_bounds(bins[bin], items[i].bounds);
+                }
+
+                std::array<light_bounds, NUM_BINS - 1> right_bounds;
+                right_bounds[NUM_BINS - 2] = bins[NUM_BINS - 1];
+                for (int i = NUM_BINS - 3; i >= 0; --i)
+                    right_bounds[i] = light_bounds(right_bounds[i + 1], bins[i + 1]);
+
+                light_bounds left_bounds;
+                for (int i = 0; i < NUM_BINS - 1; ++i) {
+                    left_bounds = light_bounds(left_bounds, bins[i]);
+                    if (left_bounds.is_empty() || right_bounds[i].is_empty())
+                        continue;
+                    double cost = split_cost(left_bounds, bounds, axis) + split_cost(right_bounds[i], bounds, axis);
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = i;
+                    }
+                }
+            }
+        }
+
+        if (best_axis >= 0) {
+            const interval& axis_interval = centroid_bounds.axis_interval(best_axis);
+            auto split = std::partition(items.begin() + start, items.begin() + end, [&](const build_item& item) {
+                return bin_index(item.bounds.centroid()[best_axis], axis_interval) <= best_bin;
+            });
+            mid = split - items.begin();
+        }
+        if (mid <= start || mid >= end) {
+            // No useful split was found, fall back to the median along the widest axis
+            vec3 extent = centroid_bounds.size();
+            int axis = (extent.x() > extent.y() && extent.x() > extent.z()) ? 0 : (extent.y() > extent.z() ? 1 : 2);
+            mid = (start + end) / 2;
+            std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                             [axis](const build_item& a, const build_item& b) {
+                                 return a.bounds.centroid()[axis] < b.bounds.centroid()[axis];
+                             });
+        }
+
+        build_recursive(items, start, mid, trail, depth + 1);
+        int right = build_recursive(items, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+        nodes[node_index].bounds = light_bounds(nodes[node_index + 1].bounds, nodes[right].bounds);
+        nodes[node_index].index = right;
+        nodes[node_index].is_leaf = false;
+        return node_index;
+    }
+
+    static int bin_index(double centroid, const interval& axis_interval) {
+        int bin = int(NUM_BINS * (centroid - axis_interval.min) / axis_interval.size());
+        return std::clamp(bin, 0, NUM_BINS - 1);
+    }
+};
+
+#endif
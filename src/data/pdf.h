@@ -43,17 +43,18 @@ class cosine_pdf : public pdf {
 };
 class mixture_pdf : public pdf {
   public:
-    mixture_pdf(pdf* p0, pdf* p1) {
+    // weight is the probability of sampling p0
+    mixture_pdf(pdf* p0, pdf* p1, double weight = 0.5) : weight(weight) {
         p[0] = p0;
         p[1] = p1;
     }
 
     double value(const vec3& direction) const override {
-        return 0.5 * p[0]->value(direction) + 0.5 *p[1]->value(direction);
+        return weight * p[0]->value(direction) + (1.0 - weight) * p[1]->value(direction);
     }
 
     vec3 generate() const override {
-        if (random_double() < 0.5)
+        if (random_double() < weight)
             return p[0]->generate();
         else
             return p[1]->generate();
@@ -61,6 +62,7 @@ class mixture_pdf : public pdf {
 
   private:
     pdf* p[2];
+    double weight;
 };
 class hittable_pdf : public pdf {
   public:
@@ -0,0 +1,102 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "hittable.h"
+#include "spectrum.h"
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// A photon carries the power of a single wavelength band, so dispersion and
+// spectral filtering along its path need no special handling.
+struct photon {
+    point3 p;
+    vec3 wi;        // Towards where the photon came from
+    float power;
+    int band;
+};
+
+// Photons sorted into a hashed uniform grid with cells as large as the gather
+// radius. Photons of one cell are contiguous in memory, so a lookup reads the
+// 27 cells around the query point as a handful of linear runs.
+class photon_map {
+  public:
+    photon_map() {}
+
+    void build(std::vector<photon>&& stored, double gather_radius) {
+        photons = std::move(stored);
+        radius = gather_radius;
+        inv_cell_size = 1.0 / radius;
+
+        size_t table_size = 1;
+        while (table_size < 2 * photons.size())
+            table_size <<= 1;
+        mask = table_size - 1;
+
+        // Counting sort by cell hash
+        cell_start.assign(table_size + 1, 0);
+        std::vector<uint32_t> hashes(photons.size());
+        for (size_t i = 0; i < photons.size(); ++i) {
+            hashes[i] = cell_hash(cell_coord(photons[i].p.x()), cell_coord(photons[i].p.y()), cell_coord(photons[i].p.z()));
+            cell_start[hashes[i] + 1]++;
+        }
+        for (size_t i = 0; i < table_size; ++i)
+            cell_start[i + 1] += cell_start[i];
+        std::vector<photon> sorted(photons.size());
+        std::vector<uint32_t> offset(cell_start.begin(), cell_start.end() - 1);
+        for (size_t i = 0; i < photons.size(); ++i)
+            sorted[offset[hashes[i]]++] = photons[i];
+        photons.swap(sorted);
+    }
+
+    bool empty() const { return photons.empty(); }
+    size_t size() const { return photons.size(); }
+    double get_radius() const { return radius; }
+
+    // Flux density per wavelength band arriving at p on the side n faces,
+    // estimated with a disc of the gather radius.
+    spectrum irradiance(const point3& p, const vec3& n) const {
+        spectrum result;
+        if (photons.empty())
+            return result;
+
+        const double radius2 = radius * radius;
+        int cx = cell_coord(p.x()), cy = cell_coord(p.y()), cz = cell_coord(p.z());
+        // Neighbouring cells may share a hash, so each bucket is visited only once
+        uint32_t visited[27];
+        int num_visited = 0;
+        for (int dz = -1; dz <= 1; ++dz) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    uint32_t h = cell_hash(cx + dx, cy + dy, cz + dz);
+                    if (std::find(visited, visited + num_visited, h) != visited + num_visited)
+                        continue;
+                    visited[num_visited++] = h;
+                    for (uint32_t i = cell_start[h]; i < cell_start[h + 1]; ++i) {
+                        const photon& ph = photons[i];
+                        if ((ph.p - p).length_squared() > radius2 || dot(ph.wi, n) <= 0)
+                            continue;
+                        result[ph.band] += ph.power;
+                    }
+                }
+            }
+        }
+        return result / (pi * radius2);
+    }
+
+  private:
+    std::vector<photon> photons;
+    std::vector<uint32_t> cell_start;
+    uint32_t mask = 0;
+    double radius = 1.0;
+    double inv_cell_size = 1.0;
+
+    int cell_coord(double x) const {
+        return int(std::floor(x * inv_cell_size));
+    }
+    uint32_t cell_hash(int x, int y, int z) const {
+        return (uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u) & mask;
+    }
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "hittable.h"
+#include "spectrum.h"
+#include "sd_tree.h"
+#include <atomic>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+// Exitant radiance cached in a hashed world-space grid, after Gautron 2020,
+// "Real-Time Ray-Traced Ambient Occlusion of Complex Scenes using Spatial
+// Hashing". Cells grow with the distance to the camera so the cache has
+// roughly the same resolution on screen everywhere, and surfaces facing
+// different axes fall into different cells. All threads add to the same
+// table without locking; a cell is claimed by the first thread to write it.
+class radiance_cache {
+  public:
+    radiance_cache(double cell_size, int memory_mb) : cell_size(cell_size) {
+        size_t count = 1;
+        while ((count << 1) * sizeof(cell) <= size_t(memory_mb) * 1024 * 1024)
+            count <<= 1;
+        cells = std::vector<cell>(count);
+        mask = count - 1;
+        std::cout << "Radiance cache: " << count << " cells of " << cell_size << std::endl;
+    }
+
+    void set_camera(const point3& position) {
+        camera = position;
+    }
+
+    // Forgets everything, e.g. after the lights changed
+    void clear() {
+        for (cell& c : cells) {
+            c.key.store(0, std::memory_order_relaxed);
+            c.weight.store(0.0f);
+            for (atomic_float& s : c.sum)
+                s.store(0.0f);
+        }
+    }
+
+    void add(const point3& p, const vec3& n, const spectrum& radiance) {
+        if (!std::isfinite(radiance.average()))
+            return;
+        cell * c = claim(key(p, n));
+        if (!c)
+            return;
+        const float* samples = radiance.get_data().data();
+        for (int i = 0; i < spectrum::RESPONSE_SAMPLES; ++i)
+            c->sum[i].add(samples[i]);
+        c->weight.add(1.0f);
+    }
+
+    // Mean radiance of the cell around p, once it has seen enough samples
+    bool lookup(const point3& p, const vec3& n, spectrum& radiance) const {
+        const cell * c = find(key(p, n));
+        if (!c)
+            return false;
+        float weight = c->weight.load();
+        if (weight < MIN_SAMPLES)
+            return false;
+        for (int i = 0; i < spectrum::RESPONSE_SAMPLES; ++i)
+            radiance[i] = c->sum[i].load() / weight;
+        return true;
+    }
+
+  private:
+    static constexpr float MIN_SAMPLES = 4.0f;
+    static constexpr int MAX_PROBES = 8;
+    static constexpr int MAX_LEVEL = 15;
+
+    struct cell {
+        std::atomic<uint64_t> key{0};
+        atomic_float weight;
+        std::array<atomic_float, spectrum::RESPONSE_SAMPLES> sum;
+    };
+
+    std::vector<cell> cells;
+    uint64_t mask = 0;
+    double cell_size;
+    point3 camera;
+
+    // Quantised position, level of detail and dominant normal axis. 0 marks an empty cell.
+    uint64_t key(const point3& p, const vec3& n) const {
+        double distance = (p - camera).length();
+        int level = std::clamp(int(std::log2(std::max(distance / (cell_size * 64), 1.0))), 0, MAX_LEVEL);
+        double size = cell_size * (1 << level);
+        uint64_t x = uint64_t(int64_t(std::floor(p.x() / size)) & 0x1ffff);
+        uint64_t y = uint64_t(int64_t(std::floor(p.y() / size)) & 0x1ffff);
+        uint64_t z = uint64_t(int64_t(std::floor(p.z() / size)) & 0x1ffff);
+        int axis = std::fabs(n.x()) > std::fabs(n.y()) ? (std::fabs(n.x()) > std::fabs(n.z()) ? 0 : 2) : (std::fabs(n.y()) > std::fabs(n.z()) ? 1 : 2);
+        uint64_t facing = uint64_t(axis * 2 + (n[axis] < 0 ? 1 : 0));
+        return ((x << 41) | (y << 24) | (z << 7) | (uint64_t(level) << 3) | facing) + 1;
+    }
+
+    // splitmix64 finaliser, every key bit reaches the low bits used as the index
+    static uint64_t slot(uint64_t k) {
+        k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ull;
+        k = (k ^ (k >> 27)) * 0x94d049bb133111ebull;
+        return k ^ (k >> 31);
+    }
+
+    // Linear probing over a few slots, the cache simply drops samples when they are all taken
+    cell * claim(uint64_t k) {
+        uint64_t h = slot(k);
+        for (int probe = 0; probe < MAX_PROBES; ++probe) {
+            cell& c = cells[(h + probe) & mask];
+            uint64_t current = c.key.load(std::memory_order_relaxed);
+            if (current == 0 && !c.key.compare_exchange_strong(current, k, std::memory_order_relaxed) && current != k)
+                continue;
+            if (current == 0 || current == k)
+                return &c;
+        }
+        return nullptr;
+    }
+    const cell * find(uint64_t k) const {
+        uint64_t h = slot(k);
+        for (int probe = 0; probe < MAX_PROBES; ++probe) {
+            const cell& c = cells[(h + probe) & mask];
+            uint64_t current = c.key.load(std::memory_order_relaxed);
+            if (current == k)
+                return &c;
+            if (current == 0)
+                return nullptr;
+        }
+        return nullptr;
+    }
+};
+
+#endif
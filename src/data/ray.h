@@ -3,12 +3,18 @@
 
 #include "vec3.h"
 
+// Camera path state, used to hand caustics over to the photon map
+const int PATH_DIFFUSE = 1;    // The path has passed a diffuse vertex
+const int PATH_CAUSTIC = 2;    // Caustics at the last diffuse vertex were gathered from photons
+const int PATH_SPECULAR = 4;   // A specular bounce followed the last diffuse vertex
+
 class ray {
   public:
     ray() {}
 
     ray(const point3& origin, const vec3& direction, const int depth = 0) : orig(origin), dir(direction), depth(depth) {}
     float wavelength = -1.0;
+    int path_flags = 0;
     const point3& origin() const  { return orig; }
     const vec3& direction() const { return dir; }
 
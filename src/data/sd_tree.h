@@ -0,0 +1,342 @@
+#ifndef SD_TREE_H
+#define SD_TREE_H
+
+#include "hittable.h"
+#include "pdf.h"
+#include <atomic>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+// Spatial-directional tree for path guiding, after Mueller et al. 2017,
+// "Practical Path Guiding for Efficient Light-Transport Simulation".
+// A binary tree over the scene bounds stores in each leaf a quadtree over
+// the sphere of directions that learns where incident radiance comes from.
+
+// Float with lock-free accumulation, std::atomic<float>::fetch_add needs C++20
+class atomic_float {
+  public:
+    atomic_float(float v = 0.0f) : value(v) {}
+    atomic_float(const atomic_float& other) : value(other.load()) {}
+    atomic_float& operator=(const atomic_float& other) {
+        value.store(other.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    float load() const { return value.load(std::memory_order_relaxed); }
+    void store(float v) { value.store(v, std::memory_order_relaxed); }
+    void add(float v) {
+        float current = value.load(std::memory_order_relaxed);
+        while (!value.compare_exchange_weak(current, current + v, std::memory_order_relaxed)) {}
+    }
+
+  private:
+    std::atomic<float> value;
+};
+
+// Quadtree over the cylindrical mapping (cos theta, phi) of the sphere. The
+// mapping preserves area, so a uniform density on the square is 1/(4 pi) sr.
+class dtree {
+  public:
+    struct node {
+        std::array<atomic_float, 4> sum;
+        // Child i covers quadrant i, x in the low bit and y in the high bit. 0 marks a leaf.
+        std::array<uint32_t, 4> child = {0, 0, 0, 0};
+
+        bool is_leaf(int i) const { return child[i] == 0; }
+        float total() const { return sum[0].load() + sum[1].load() + sum[2].load() + sum[3].load(); }
+    };
+
+    dtree() { nodes.emplace_back(); }
+
+    size_t num_nodes() const { return nodes.size(); }
+    float total() const { return nodes[0].total(); }
+    float sample_weight() const { return samples.load(); }
+    void set_sample_weight(float weight) { samples.store(weight); }
+
+    void record(const vec3& direction, float radiance) {
+        if (!(radiance >= 0) || !std::isfinite(radiance))
+            return;
+        samples.add(1.0f);
+        double x, y;
+        to_canonical(direction, x, y);
+        uint32_t index = 0;
+        while (true) {
+            int quadrant = descend(x, y);
+            nodes[index].sum[quadrant].add(radiance);
+            if (nodes[index].is_leaf(quadrant))
+                break;
+            index = nodes[index].child[quadrant];
+        }
+    }
+
+    double pdf(const vec3& direction) const {
+        float root_total = total();
+        if (root_total <= 0)
+            return 1.0 / (4 * pi);
+
+        double x, y;
+        to_canonical(direction, x, y);
+        double density = 1.0;
+        uint32_t index = 0;
+        while (true) {
+            const node& n = nodes[index];
+            int quadrant = descend(x, y);
+            float node_total = n.total();
+            float quadrant_sum = n.sum[quadrant].load();
+            if (node_total <= 0 || quadrant_sum <= 0)
+                return 0.0;
+            density *= 4.0 * quadrant_sum / node_total;
+            if (n.is_leaf(quadrant))
+                break;
+            index = n.child[quadrant];
+        }
+        return density / (4 * pi);
+    }
+
+    vec3 sample(double u1, double u2) const {
+        if (total() <= 0)
+            return from_canonical(u1, u2);
+
+        double origin_x = 0.0, origin_y = 0.0, size = 1.0;
+        uint32_t index = 0;
+        while (true) {
+            const node& n = nodes[index];
+            float s[4] = {n.sum[0].load(), n.sum[1].load(), n.sum[2].load(), n.sum[3].load()};
+            float total_sum = s[0] + s[1] + s[2] + s[3];
+
+            // Pick the column first, then the row within it
+            double p_low_x = (s[0] + s[2]) / total_sum;
+            int qx = u1 < p_low_x ? 0 : 1;
+            u1 = qx == 0 ? u1 / p_low_x : (u1 - p_low_x) / (1 - p_low_x);
+            double column = qx == 0 ? s[0] + s[2] : s[1] + s[3];
+            double p_low_y = s[qx] / column;
+            int qy = u2 < p_low_y ? 0 : 1;
+            u2 = qy == 0 ? u2 / p_low_y : (u2 - p_low_y) / (1 - p_low_y);
+            u1 = std::clamp(u1, 0.0, one_minus_epsilon);
+            u2 = std::clamp(u2, 0.0, one_minus_epsilon);
+
+            size *= 0.5;
+            origin_x += qx * size;
+            origin_y += qy * size;
+            int quadrant = qx + 2 * qy;
+            if (n.is_leaf(quadrant))
+                break;
+            index = n.child[quadrant];
+        }
+        return from_canonical(origin_x + u1 * size, origin_y + u2 * size);
+    }
+
+    // New empty tree whose structure follows the energy recorded in this one.
+    // Quadrants holding more than rho of the total are subdivided, up to
+    // max_nodes nodes in total.
+    dtree refined(double rho, size_t max_nodes) const {
+        dtree result;
+        float root_total = total();
+        if (root_total <= 0)
+            return result;
+
+        struct entry {
+            uint32_t target;
+            int source;     // Node in this tree, -1 once below its leaves
+            double energy;  // Energy of the target node when source is -1
+            int depth;
+        };
+        std::vector<entry> stack;
+        stack.push_back({0, 0, root_total, 1});
+        while (!stack.empty()) {
+            entry e = stack.back();
+            stack.pop_back();
+            for (int quadrant = 0; quadrant < 4; ++quadrant) {
+                double energy = e.source >= 0 ? nodes[e.source].sum[quadrant].load() : e.energy / 4;
+                if (energy / root_total <= rho || e.depth >= MAX_DEPTH || result.nodes.size() >= max_nodes)
+                    continue;
+                int source = (e.source >= 0 && !nodes[e.source].is_leaf(quadrant)) ? int(nodes[e.source].child[quadrant]) : -1;
+                uint32_t child = uint32_t(result.nodes.size());
+                result.nodes.emplace_back();
+                result.nodes[e.target].child[quadrant] = child;
+                stack.push_back({child, source, energy, e.depth + 1});
+            }
+        }
+        return result;
+    }
+
+  private:
+    static constexpr double one_minus_epsilon = 0x1.fffffffffffffp-1;
+    static constexpr int MAX_DEPTH = 20;
+
+    std::vector<node> nodes;
+    atomic_float samples;
+
+    static int descend(double& x, double& y) {
+        int qx = x < 0.5 ? 0 : 1;
+        int qy = y < 0.5 ? 0 : 1;
+        x = x * 2 - qx;
+        y = y * 2 - qy;
+        return qx + 2 * qy;
+    }
+    static void to_canonical(const vec3& direction, double& x, double& y) {
+        vec3 d = unit_vector(direction);
+        double cos_theta = std::clamp(d.z(), -1.0, 1.0);
+        double phi = std::atan2(d.y(), d.x());
+        if (phi < 0)
+            phi += 2 * pi;
+        x = std::clamp((cos_theta + 1) / 2, 0.0, one_minus_epsilon);
+        y = std::clamp(phi / (2 * pi), 0.0, one_minus_epsilon);
+    }
+    static vec3 from_canonical(double x, double y) {
+        double cos_theta = 2 * x - 1;
+        double phi = 2 * pi * y;
+        double sin_theta = std::sqrt(std::max(0.0, 1 - cos_theta * cos_theta));
+        return vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+    }
+};
+
+class sd_tree {
+  public:
+    // Fraction of the directional energy above which a quadrant is split
+    double rho = 0.01;
+    // Spatial leaves are split once they received c * sqrt(2^iteration) samples
+    double spatial_threshold = 12000.0;
+
+    sd_tree(const aabb& bounds, size_t memory_budget_mb) : bounds(bounds) {
+        max_bytes = memory_budget_mb * 1024 * 1024;
+        reset();
+    }
+
+    void reset() {
+        spatial_nodes.clear();
+        leaves.clear();
+        spatial_nodes.push_back({0, {0, 0}, 0});
+        leaves.emplace_back();
+        training = true;
+    }
+
+    bool is_training() const { return training; }
+    void freeze() { training = false; }
+
+    // Directional distribution learnt for the region around p, or nullptr when
+    // nothing has been learnt there yet.
+    const dtree * sampling_tree(const point3& p) const {
+        const dtree& tree = leaves[leaf_index(p)].sampling;
+        return tree.total() > 0 ? &tree : nullptr;
+    }
+
+    // Thread-safe during an iteration: the structure only changes in refine().
+    void record(const point3& p, const vec3& direction, float radiance) {
+        if (!training)
+            return;
+        leaves[leaf_index(p)].building.record(direction, radiance);
+    }
+
+    // Called between iterations, with no thread rendering.
+    void refine(int iteration) {
+        double threshold = spatial_threshold * std::sqrt(double(1 << iteration));
+        size_t leaf_count = leaves.size();
+        for (size_t i = 0; i < spatial_nodes.size(); ++i) {
+            if (spatial_nodes[i].leaf < 0)
+                continue;
+            leaf_data& data = leaves[spatial_nodes[i].leaf];
+            if (data.building.sample_weight() <= threshold || memory_usage() + leaf_bytes(data) > max_bytes)
+                continue;
+            split(int(i));
+        }
+        // Each leaf samples from what it learnt and starts a new, finer tree
+        size_t max_nodes = std::max<size_t>(1, max_bytes / (2 * leaves.size() * sizeof(dtree::node)));
+        for (auto& data : leaves) {
+            data.sampling = data.building;
+            data.building = data.sampling.refined(rho, max_nodes);
+        }
+        std::cout << "Path guiding iteration " << iteration << ": "
+                  << spatial_nodes.size() << " spatial nodes (" << leaf_count << " -> " << leaves.size() << " leaves), "
+                  << directional_nodes() << " directional nodes, "
+                  << memory_usage() / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+
+    size_t directional_nodes() const {
+        size_t count = 0;
+        for (const auto& data : leaves)
+            count += data.sampling.num_nodes() + data.building.num_nodes();
+        return count;
+    }
+    size_t memory_usage() const {
+        return spatial_nodes.size() * sizeof(spatial_node) + leaves.size() * sizeof(leaf_data) +
+               directional_nodes() * sizeof(dtree::node);
+    }
+
+  private:
+    struct spatial_node {
+        int leaf;                  // Index into leaves, -1 for interior nodes
+        std::array<int, 2> child;
+        int axis;
+    };
+    struct leaf_data {
+        dtree sampling;
+        dtree building;
+    };
+
+    aabb bounds;
+    size_t max_bytes;
+    bool training = true;
+    std::vector<spatial_node> spatial_nodes;
+    std::vector<leaf_data> leaves;
+
+    static size_t leaf_bytes(const leaf_data& data) {
+        return sizeof(leaf_data) + 2 * sizeof(spatial_node) +
+               (data.sampling.num_nodes() + data.building.num_nodes()) * sizeof(dtree::node);
+    }
+
+    int leaf_index(const point3& p) const {
+        double x[3];
+        for (int a = 0; a < 3; ++a) {
+            const interval& axis = bounds.axis_interval(a);
+            x[a] = axis.size() > 0 ? std::clamp((p[a] - axis.min) / axis.size(), 0.0, 1.0) : 0.5;
+        }
+        int index = 0;
+        while (spatial_nodes[index].leaf < 0) {
+            const spatial_node& n = spatial_nodes[index];
+            int side = x[n.axis] < 0.5 ? 0 : 1;
+            x[n.axis] = x[n.axis] * 2 - side;
+            index = n.child[side];
+        }
+        return spatial_nodes[index].leaf;
+    }
+
+    // Halve a leaf along the next axis. Both halves start from the parent's
+    // distributions with half of its samples, so they are split again in the
+    // same pass only if they are still above the threshold.
+    void split(int index) {
+        int depth_axis = spatial_nodes[index].axis;
+        int leaf = spatial_nodes[index].leaf;
+        leaves[leaf].building.set_sample_weight(leaves[leaf].building.sample_weight() / 2);
+        leaf_data copy = leaves[leaf];
+        int second_leaf = int(leaves.size());
+        leaves.push_back(copy);
+
+        int first = int(spatial_nodes.size());
+        spatial_nodes.push_back({leaf, {0, 0}, (depth_axis + 1) % 3});
+        spatial_nodes.push_back({second_leaf, {0, 0}, (depth_axis + 1) % 3});
+        spatial_nodes[index].leaf = -1;
+        spatial_nodes[index].child = {first, first + 1};
+    }
+};
+
+// Samples directions from the quadtree of an sd_tree leaf
+class guided_pdf : public pdf {
+  public:
+    guided_pdf(const dtree * tree) : tree(tree) {}
+
+    double value(const vec3& direction) const override {
+        return tree->pdf(direction);
+    }
+
+    vec3 generate() const override {
+        return tree->sample(random_double(), random_double());
+    }
+
+  private:
+    const dtree * tree;
+};
+
+#endif
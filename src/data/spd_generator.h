@@ -1,18 +1,32 @@
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <iterator>
+#include "spectrum.h"
 
 class SPDGenerator {
 private:
-    static constexpr int RESPONSE_SAMPLES = 31;
-    static constexpr float START_WAVELENGTH = 400.0f;
-    static constexpr float END_WAVELENGTH = 700.0f;
+    static constexpr int RESPONSE_SAMPLES = spectrum::RESPONSE_SAMPLES;
+    static constexpr float START_WAVELENGTH = spectrum::START_WAVELENGTH;
+    static constexpr float END_WAVELENGTH = spectrum::END_WAVELENGTH;
     static constexpr float WAVELENGTH_STEP = (END_WAVELENGTH - START_WAVELENGTH) / (RESPONSE_SAMPLES - 1);
 
-    // CIE daylight model coefficients
-    static constexpr double S0[] = {0.04, 6.0, 29.6, 55.3, 57.3, 61.8, 61.5, 68.8, 63.4, 65.8, 94.8, 104.8, 105.9, 96.8, 113.9, 125.6, 125.5, 121.3, 121.3, 113.5, 113.1, 110.8, 106.5, 108.8, 105.3, 104.4, 100.0, 96.0, 95.1, 89.1, 90.5};
-    static constexpr double S1[] = {0.02, 4.5, 22.4, 42.0, 40.6, 41.6, 38.0, 42.4, 38.5, 35.0, 43.4, 46.3, 43.9, 37.1, 36.7, 35.9, 32.6, 27.9, 24.3, 20.1, 16.2, 13.2, 8.6, 6.1, 4.2, 1.9, 0.0, -1.6, -3.5, -3.5, -5.8};
-    static constexpr double S2[] = {0.0, 2.0, 4.0, 8.5, 7.8, 6.7, 5.3, 6.1, 3.0, 1.2, -1.1, -0.5, -0.7, -1.2, -2.6, -2.9, -2.8, -2.6, -2.6, -1.8, -1.5, -1.3, -1.2, -1.0, -0.5, -0.3, 0.0, 0.2, 0.5, 2.1, 3.2};
+    // CIE daylight components S0, S1 and S2 (CIE 15:2004, table T.2), 54
+    // samples in 10nm steps from 300nm to 830nm
+    static constexpr int BASIS_SAMPLES = 54;
+    static constexpr double BASIS_START = 300.0;
+    static constexpr double BASIS_STEP = 10.0;
+    static constexpr double S0[] = {0.04, 6.0, 29.6, 55.3, 57.3, 61.8, 61.5, 68.8, 63.4, 65.8, 94.8, 104.8, 105.9, 96.8, 113.9, 125.6, 125.5, 121.3,
+                                    121.3, 113.5, 113.1, 110.8, 106.5, 108.8, 105.3, 104.4, 100.0, 96.0, 95.1, 89.1, 90.5, 90.3, 88.4, 84.0, 85.1, 81.9,
+                                    82.6, 84.9, 81.3, 71.9, 74.3, 76.4, 63.3, 71.7, 77.0, 65.2, 47.7, 68.6, 65.0, 66.0, 61.0, 53.3, 58.9, 61.9};
+    static constexpr double S1[] = {0.02, 4.5, 22.4, 42.0, 40.6, 41.6, 38.0, 42.4, 38.5, 35.0, 43.4, 46.3, 43.9, 37.1, 36.7, 35.9, 32.6, 27.9,
+                                    24.3, 20.1, 16.2, 13.2, 8.6, 6.1, 4.2, 1.9, 0.0, -1.6, -3.5, -3.5, -5.8, -7.2, -8.6, -9.5, -10.9, -10.7,
+                                    -12.0, -14.0, -13.6, -12.0, -13.3, -12.9, -10.6, -11.6, -12.2, -10.2, -7.8, -11.2, -10.4, -10.6, -9.7, -8.3, -9.3, -9.8};
+    static constexpr double S2[] = {0.0, 2.0, 4.0, 8.5, 7.8, 6.7, 5.3, 6.1, 3.0, 1.2, -1.1, -0.5, -0.7, -1.2, -2.6, -2.9, -2.8, -2.6,
+                                    -2.6, -1.8, -1.5, -1.3, -1.2, -1.0, -0.5, -0.3, 0.0, 0.2, 0.5, 2.1, 3.2, 4.1, 4.7, 5.1, 6.7, 7.3,
+                                    8.6, 9.8, 10.2, 8.3, 9.6, 8.5, 7.0, 7.6, 8.0, 6.7, 5.2, 7.4, 6.8, 7.0, 6.4, 5.5, 6.1, 6.5};
+    static_assert(std::size(S0) == BASIS_SAMPLES && std::size(S1) == BASIS_SAMPLES && std::size(S2) == BASIS_SAMPLES,
+                  "Daylight basis tables must cover 300nm to 830nm");
 
 public:
     static std::vector<double> generateSPD(double temperature) {
@@ -32,7 +46,8 @@ public:
             double M2 = (0.0300 - 31.4424 * xD + 30.0717 * yD) / (0.0241 + 0.2562 * xD - 0.7341 * yD);
 
             for (int i = 0; i < RESPONSE_SAMPLES; ++i) {
-                spd[i] = S0[i] + M1 * S1[i] + M2 * S2[i];
+                double wavelength = START_WAVELENGTH + i * WAVELENGTH_STEP;
+                spd[i] = basis(S0, wavelength) + M1 * basis(S1, wavelength) + M2 * basis(S2, wavelength);
             }
         }
 
@@ -46,6 +61,14 @@ public:
     }
 
 private:
+    // Linear interpolation in a basis table, holding the end values outside it
+    static double basis(const double* table, double wavelength) {
+        double position = std::clamp((wavelength - BASIS_START) / BASIS_STEP, 0.0, double(BASIS_SAMPLES - 1));
+        int index = std::min(int(position), BASIS_SAMPLES - 2);
+        double t = position - index;
+        return table[index] * (1.0 - t) + table[index + 1] * t;
+    }
+
     static double blackBodySpectrum(double wavelength, double temperature) {
         const double h = 6.62607015e-34; // Planck constant
         const double c = 299792458.0;    // Speed of light
@@ -0,0 +1,255 @@
+#ifndef SPECTRAL_BASIS_H
+#define SPECTRAL_BASIS_H
+
+#include "spectral_net.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+// Orthonormal basis of the radiance spectra a render is likely to produce,
+// for films that store a handful of coefficients per pixel instead of every
+// sample.
+//
+// The first three components span the observer's colour matching
+// functions, so XYZ, and the PNG, come out of the coefficients exactly. The
+// rest are the principal components of what those three leave behind, fitted
+// once from the illuminants in spectrum.h, alone and reflected once and
+// twice off uplifted reflectances from a grid over the RGB cube. Nothing is
+// centred, so projecting is linear: the coefficients of a sum of samples are
+// the sum of their coefficients, and pixels can be accumulated and blended
+// in coefficient space.
+class spectral_basis {
+  public:
+    static constexpr int MIN_COMPONENTS = 3;
+
+    spectral_basis(int components, const observer* obs) {
+        const int n = spectrum::RESPONSE_SAMPLES;
+        components_ = std::min(std::max(components, MIN_COMPONENTS), n);
+        stride_ = padded(n);
+        rows_.assign(size_t(components_) * stride_, 0.0f);
+
+        // Gram-Schmidt over the XYZ weight rows
+        std::vector<double> q(size_t(3) * n, 0.0);
+        for (int k = 0; k < 3; ++k) {
+            double* v = q.data() + size_t(k) * n;
+            for (int i = 0; i < obs->weight_count(); ++i)
+                v[i] = obs->weights(k)[i];
+            for (int j = 0; j < k; ++j) {
+                const double* u = q.data() + size_t(j) * n;
+                double d = std::inner_product(v, v + n, u, 0.0);
+                for (int i = 0; i < n; ++i)
+                    v[i] -= d * u[i];
+            }
+            double length = std::sqrt(std::inner_product(v, v + n, v, 0.0));
+            for (int i = 0; i < n; ++i)
+                v[i] /= length;
+        }
+
+        // Second moment of the training spectra with their XYZ part removed
+        std::vector<std::vector<float>> training = training_set();
+        std::vector<double> moment(size_t(n) * n, 0.0), residual(n);
+        for (const std::vector<float>& s : training) {
+            for (int i = 0; i < n; ++i)
+                residual[i] = s[i];
+            for (int k = 0; k < 3; ++k) {
+                const double* u = q.data() + size_t(k) * n;
+                double d = std::inner_product(residual.begin(), residual.end(), u, 0.0);
+                for (int i = 0; i < n; ++i)
+                    residual[i] -= d * u[i];
+            }
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < n; ++j)
+                    moment[size_t(i) * n + j] += residual[i] * residual[j];
+        }
+
+        std::vector<double> vectors;
+        std::vector<double> values = eigen(moment, n, vectors);
+        std::vector<int> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return values[a] > values[b]; });
+
+        for (int k = 0; k < 3; ++k)
+            for (int i = 0; i < n; ++i)
+                rows_[size_t(k) * stride_ + i] = float(q[size_t(k) * n + i]);
+        for (int k = 3; k < components_; ++k) {
+            // Columns of vectors are the eigenvectors; the sign is chosen so
+            // the samples of each component sum to a positive value
+            int column = order[k - 3];
+            double sum = 0.0;
+            for (int i = 0; i < n; ++i)
+                sum += vectors[size_t(i) * n + column];
+            double sign = sum < 0.0 ? -1.0 : 1.0;
+            for (int i = 0; i < n; ++i)
+                rows_[size_t(k) * stride_ + i] = float(sign * vectors[size_t(i) * n + column]);
+        }
+
+        // Relative L2 error of the training spectra after a round trip
+        double error_sum = 0.0;
+        std::vector<float> coefficients(components_), reconstructed(stride_);
+        for (const std::vector<float>& s : training) {
+            project(s.data(), coefficients.data());
+            reconstruct(coefficients.data(), reconstructed.data());
+            double error = 0.0;
+            for (int i = 0; i < n; ++i)
+                error += (reconstructed[i] - s[i]) * (reconstructed[i] - s[i]);
+            error = std::sqrt(error);
+            error_sum += error;
+            max_error_ = std::max(max_error_, error);
+        }
+        mean_error_ = training.empty() ? 0.0 : error_sum / training.size();
+        training_size_ = int(training.size());
+    }
+
+    int components() const { return components_; }
+    // Sample i of component k
+    float at(int k, int i) const { return rows_[size_t(k) * stride_ + i]; }
+    const float* row(int k) const { return rows_.data() + size_t(k) * stride_; }
+
+    // Coefficients of RESPONSE_SAMPLES samples
+    void project(const float* samples, float* coefficients) const {
+        const int n = spectrum::RESPONSE_SAMPLES;
+        for (int k = 0; k < components_; ++k) {
+            const float* b = row(k);
+            spectrum_simd::lane sum = spectrum_simd::set1(0.0f);
+            int i = 0;
+            for (; i + spectrum_simd::WIDTH <= n; i += spectrum_simd::WIDTH)
+                sum = spectrum_simd::fmadd(spectrum_simd::loadu(samples + i), spectrum_simd::loadu(b + i), sum);
+            float total = spectrum_simd::reduce(sum);
+            for (; i < n; ++i)
+                total += samples[i] * b[i];
+            coefficients[k] = total;
+        }
+    }
+    // Samples of the spectrum with the given coefficients. samples must hold
+    // RESPONSE_SAMPLES floats rounded up to whole SIMD lanes.
+    void reconstruct(const float* coefficients, float* samples) const {
+        for (int i = 0; i < stride_; i += spectrum_simd::WIDTH) {
+            spectrum_simd::lane sum = spectrum_simd::set1(0.0f);
+            for (int k = 0; k < components_; ++k)
+                sum = spectrum_simd::fmadd(spectrum_simd::set1(coefficients[k]), spectrum_simd::loadu(row(k) + i), sum);
+            spectrum_simd::storeu(samples + i, sum);
+        }
+    }
+    spectrum reconstruct(const float* coefficients) const {
+        std::vector<float> samples(stride_);
+        reconstruct(coefficients, samples.data());
+        return spectrum(samples.data());
+    }
+
+    // Floats reconstruct writes
+    int padded_samples() const { return stride_; }
+
+    void report(std::ostream& os) const {
+        os << "Spectral basis: " << components_ << " of " << spectrum::RESPONSE_SAMPLES << " components, relative error mean "
+           << mean_error_ << ", max " << max_error_ << " over " << training_size_ << " training spectra" << std::endl;
+    }
+    double mean_error() const { return mean_error_; }
+    double max_error() const { return max_error_; }
+
+  private:
+    int components_ = 0;
+    int stride_ = 0;
+    std::vector<float> rows_;     // components x stride, zero past the last sample
+    double mean_error_ = 0.0;
+    double max_error_ = 0.0;
+    int training_size_ = 0;
+
+    static int padded(int count) {
+        return (count + spectrum_simd::WIDTH - 1) / spectrum_simd::WIDTH * spectrum_simd::WIDTH;
+    }
+
+    // Every illuminant, and its light after one and two bounces off each
+    // reflectance of an RGB grid, scaled to unit length so bright lights do
+    // not outweigh the rest
+    static std::vector<std::vector<float>> training_set() {
+        const int steps = 8;
+        std::vector<color> colors;
+        for (int r = 0; r <= steps; ++r)
+            for (int g = 0; g <= steps; ++g)
+                for (int b = 0; b <= steps; ++b)
+                    if (r + g + b > 0)
+                        colors.push_back(color(double(r) / steps, double(g) / steps, double(b) / steps));
+        std::vector<spectrum> reflectances(colors.size());
+        spectral_net::uplift(colors.data(), int(colors.size()), reflectances.data());
+
+        const spectrum illuminants[] = {spectrum::uniform(1.0f), spectrum::d65(), spectrum::d50(),
+                                        spectrum::d65_cb(), spectrum::d50_cb(), spectrum::studio_led()};
+        std::vector<std::vector<float>> training;
+        training.reserve(std::size(illuminants) * (2 * reflectances.size() + 1));
+        auto add = [&](const spectrum& s) {
+            spectrum::sample_view view = s.get_data();
+            std::vector<float> samples(view.begin(), view.end());
+            double length = 0.0;
+            for (float v : samples)
+                length += double(v) * v;
+            if (length <= 0.0)
+                return;
+            float scale = float(1.0 / std::sqrt(length));
+            for (float& v : samples)
+                v *= scale;
+            training.push_back(std::move(samples));
+        };
+        for (const spectrum& light : illuminants) {
+            add(light);
+            for (const spectrum& reflectance : reflectances) {
+                spectrum once = light * reflectance;
+                add(once);
+                add(once * reflectance);
+            }
+        }
+        return training;
+    }
+
+    // Eigenvalues of the symmetric n x n matrix a by cyclic Jacobi
+    // rotations, with the eigenvectors as the columns of vectors
+    static std::vector<double> eigen(std::vector<double> a, int n, std::vector<double>& vectors) {
+        vectors.assign(size_t(n) * n, 0.0);
+        for (int i = 0; i < n; ++i)
+            vectors[size_t(i) * n + i] = 1.0;
+        auto at = [&](int i, int j) -> double& { return a[size_t(i) * n + j]; };
+        for (int sweep = 0; sweep < 64; ++sweep) {
+            double off = 0.0, diagonal = 0.0;
+            for (int i = 0; i < n; ++i) {
+                diagonal += at(i, i) * at(i, i);
+                for (int j = i + 1; j < n; ++j)
+                    off += at(i, j) * at(i, j);
+            }
+            if (off <= 1e-22 * diagonal)
+                break;
+            for (int p = 0; p < n; ++p) {
+                for (int q = p + 1; q < n; ++q) {
+                    if (at(p, q) == 0.0)
+                        continue;
+                    double theta = (at(q, q) - at(p, p)) / (2.0 * at(p, q));
+                    double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                    double c = 1.0 / std::sqrt(t * t + 1.0);
+                    double s = t * c;
+                    for (int k = 0; k < n; ++k) {
+                        double akp = at(k, p), akq = at(k, q);
+                        at(k, p) = c * akp - s * akq;
+                        at(k, q) = s * akp + c * akq;
+                    }
+                    for (int k = 0; k < n; ++k) {
+                        double apk = at(p, k), aqk = at(q, k);
+                        at(p, k) = c * apk - s * aqk;
+                        at(q, k) = s * apk + c * aqk;
+                    }
+                    for (int k = 0; k < n; ++k) {
+                        double vkp = vectors[size_t(k) * n + p], vkq = vectors[size_t(k) * n + q];
+                        vectors[size_t(k) * n + p] = c * vkp - s * vkq;
+                        vectors[size_t(k) * n + q] = s * vkp + c * vkq;
+                    }
+                }
+            }
+        }
+        std::vector<double> values(n);
+        for (int i = 0; i < n; ++i)
+            values[i] = at(i, i);
+        return values;
+    }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef SPECTRAL_FIT_H
+#define SPECTRAL_FIT_H
+
+#include "spectrum.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+// Fits the three polynomial coefficients of spectrum's sigmoid model to an
+// RGB colour with Levenberg-Marquardt. The spectrum to RGB projection is
+// linear, so it is folded into one 3 x N response matrix up front and the
+// residual and its Jacobian come out of a single pass over the samples:
+//
+//   rgb = R s,  s_i = S(a x_i^2 + b x_i + c),  dS/dy = 0.5 / (1 + y^2)^1.5
+class spectral_fit {
+  public:
+    // Euclidean RGB distance the fit stops at
+    static constexpr double TOLERANCE = 1e-5;
+    static constexpr int ITERATION_LIMIT = 300;
+
+    struct result {
+        vec3 coeffs;
+        double error = 0.0;
+        int iterations = 0;
+    };
+
+    struct statistics {
+        int entries = 0;
+        int above_tolerance = 0;
+        double mean_error = 0.0;
+        double max_error = 0.0;
+        double mean_iterations = 0.0;
+        double seconds = 0.0;
+    };
+
+    explicit spectral_fit(const observer* obs = observer::get(observer::CIE1931_2Deg)) {
+        samples = obs->weight_count();
+        for (int row = 0; row < 3; ++row)
+            response[row].assign(samples, 0.0);
+        // Columns of the XYZ to linear RGB matrix, taken the same way
+        // spectrum::to_rgb converts
+        double to_rgb[3][3];
+        for (int column = 0; column < 3; ++column) {
+            color unit(column == 0, column == 1, column == 2, color::XYZ);
+            color rgb = unit.to_rgb();
+            for (int row = 0; row < 3; ++row)
+                to_rgb[row][column] = rgb[row];
+        }
+        for (int i = 0; i < samples; ++i) {
+            for (int row = 0; row < 3; ++row) {
+                for (int k = 0; k < 3; ++k)
+                    response[row][i] += to_rgb[row][k] * obs->weights(k)[i];
+            }
+        }
+        // The positions spectrum evaluates its polynomial at
+        x.resize(samples);
+        for (int i = 0; i < samples; ++i)
+            x[i] = double(i) / spectrum::RESPONSE_SAMPLES;
+    }
+
+    result solve(double r, double g, double b, vec3 seed) const {
+        const double target[3] = {r, g, b};
+        double c[3] = {seed.x(), seed.y(), seed.z()};
+        double residual[3], jacobian[3][3];
+        double cost = evaluate(c, target, residual, jacobian);
+        double lambda = 1e-3;
+
+        result fit;
+        for (; fit.iterations < ITERATION_LIMIT && cost > TOLERANCE * TOLERANCE; ++fit.iterations) {
+            // Normal equations J^T J d = -J^T r
+            double jtj[3][3], jtr[3];
+            for (int i = 0; i < 3; ++i) {
+                jtr[i] = 0.0;
+                for (int k = 0; k < 3; ++k)
+                    jtr[i] += jacobian[k][i] * residual[k];
+                for (int j = 0; j < 3; ++j) {
+                    jtj[i][j] = 0.0;
+                    for (int k = 0; k < 3; ++k)
+                        jtj[i][j] += jacobian[k][i] * jacobian[k][j];
+                }
+            }
+
+            bool improved = false;
+            while (lambda < 1e12) {
+                double damped[3][3];
+                for (int i = 0; i < 3; ++i) {
+                    for (int j = 0; j < 3; ++j)
+                        damped[i][j] = jtj[i][j];
+                    damped[i][i] += lambda * (jtj[i][i] + 1e-12);
+                }
+                double step[3];
+                if (solve3x3(damped, jtr, step)) {
+                    double trial[3] = {c[0] - step[0], c[1] - step[1], c[2] - step[2]};
+                    double trial_residual[3], trial_jacobian[3][3];
+                    double trial_cost = evaluate(trial, target, trial_residual, trial_jacobian);
+                    if (trial_cost < cost) {
+                        std::copy(trial, trial + 3, c);
+                        std::copy(trial_residual, trial_residual + 3, residual);
+                        std::copy(&trial_jacobian[0][0], &trial_jacobian[0][0] + 9, &jacobian[0][0]);
+                        cost = trial_cost;
+                        lambda = std::max(lambda * 0.3, 1e-9);
+                        improved = true;
+                        break;
+                    }
+                }
+                lambda *= 10.0;
+            }
+            if (!improved)
+                break;
+        }
+        fit.coeffs = vec3(c[0], c[1], c[2]);
+        fit.error = std::sqrt(cost);
+        return fit;
+    }
+
+    // Fits every point of the RGB grid. Threads take lines along blue from a
+    // shared counter, so fast and slow lines balance out. Each line starts
+    // near grey, where a flat seed converges, and walks outwards seeding
+    // every point with its solved neighbour.
+    static std::vector<vec3> compute_table(float step, int num_threads = 0, statistics* stats = nullptr) {
+        const int size = static_cast<int>(1.0 / step + 0.5) + 1;
+        std::vector<vec3> table(size_t(size) * size * size);
+        std::vector<double> errors(table.size(), 0.0);
+        std::vector<int> iterations(table.size(), 0);
+        if (num_threads <= 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        std::cout << "Computing lookup table " << size << "x" << size << "x" << size << " on " << num_threads << " threads" << std::endl;
+
+        auto start_time = std::chrono::steady_clock::now();
+        spectral_fit fit;
+        std::atomic<int> next_line(0);
+        auto worker = [&]() {
+            for (int line = next_line++; line < size * size; line = next_line++) {
+                int r_index = line / size;
+                int g_index = line % size;
+                float R = std::min(r_index * step, 1.0f);
+                float G = std::min(g_index * step, 1.0f);
+                size_t base = size_t(line) * size;
+
+                auto solve_at = [&](int b_index, vec3 seed) {
+                    float B = std::min(b_index * step, 1.0f);
+                    result solved = fit.solve(R, G, B, seed);
+                    // Neighbours near the edge of the gamut have saturated
+                    // sigmoids with next to no gradient, so a poor fit
+                    // starts over from a flat spectrum
+                    if (solved.error > TOLERANCE) {
+                        result flat = fit.solve(R, G, B, grey_seed((R + G + B) / 3.0f));
+                        flat.iterations += solved.iterations;
+                        if (flat.error < solved.error)
+                            solved = flat;
+                    }
+                    table[base + b_index] = solved.coeffs;
+                    errors[base + b_index] = solved.error;
+                    iterations[base + b_index] = solved.iterations;
+                    return solved.coeffs;
+                };
+                int middle = std::min(size - 1, (r_index + g_index + 1) / 2);
+                vec3 centre = solve_at(middle, grey_seed((R + G + middle * step) / 3.0f));
+                vec3 seed = centre;
+                for (int b_index = middle + 1; b_index < size; ++b_index)
+                    seed = solve_at(b_index, seed);
+                seed = centre;
+                for (int b_index = middle - 1; b_index >= 0; --b_index)
+                    seed = solve_at(b_index, seed);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int i = 0; i < num_threads; ++i)
+            threads.emplace_back(worker);
+        for (auto& thread : threads)
+            thread.join();
+
+        if (stats) {
+            *stats = statistics();
+            stats->entries = int(table.size());
+            for (size_t i = 0; i < table.size(); ++i) {
+                stats->mean_error += errors[i];
+                stats->max_error = std::max(stats->max_error, errors[i]);
+                stats->mean_iterations += iterations[i];
+                if (errors[i] > TOLERANCE)
+                    stats->above_tolerance++;
+            }
+            stats->mean_error /= table.size();
+            stats->mean_iterations /= table.size();
+            stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        }
+        return table;
+    }
+
+  private:
+    int samples = 0;
+    std::vector<double> response[3];
+    std::vector<double> x;
+
+    // Half the squared residual of rgb(c) - target, with its Jacobian
+    double evaluate(const double* c, const double* target, double* residual, double jacobian[3][3]) const {
+        double rgb[3] = {0.0, 0.0, 0.0};
+        double d[3][3] = {};
+        for (int i = 0; i < samples; ++i) {
+            double xi = x[i];
+            double y = (c[0] * xi + c[1]) * xi + c[2];
+            double inv = 1.0 / std::sqrt(1.0 + y * y);
+            double s = 0.5 * y * inv + 0.5;
+            double ds = 0.5 * inv * inv * inv;
+            double basis[3] = {ds * xi * xi, ds * xi, ds};
+            for (int row = 0; row < 3; ++row) {
+                double w = response[row][i];
+                rgb[row] += w * s;
+                d[row][0] += w * basis[0];
+                d[row][1] += w * basis[1];
+                d[row][2] += w * basis[2];
+            }
+        }
+        double cost = 0.0;
+        for (int row = 0; row < 3; ++row) {
+            residual[row] = rgb[row] - target[row];
+            cost += residual[row] * residual[row];
+            for (int k = 0; k < 3; ++k)
+                jacobian[row][k] = d[row][k];
+        }
+        return cost;
+    }
+
+    // Flat spectrum whose sigmoid gives the mean of the target
+    static vec3 grey_seed(float mean) {
+        double m = std::min(std::max(2.0 * mean - 1.0, -0.999), 0.999);
+        return vec3(0.0, 0.0, m / std::sqrt(1.0 - m * m));
+    }
+
+    static bool solve3x3(const double a[3][3], const double* rhs, double* out) {
+        double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+                   - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+                   + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+        if (!std::isfinite(det) || std::abs(det) < 1e-300)
+            return false;
+        double inv = 1.0 / det;
+        out[0] = inv * (rhs[0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+                      - a[0][1] * (rhs[1] * a[2][2] - a[1][2] * rhs[2])
+                      + a[0][2] * (rhs[1] * a[2][1] - a[1][1] * rhs[2]));
+        out[1] = inv * (a[0][0] * (rhs[1] * a[2][2] - a[1][2] * rhs[2])
+                      - rhs[0] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+                      + a[0][2] * (a[1][0] * rhs[2] - rhs[1] * a[2][0]));
+        out[2] = inv * (a[0][0] * (a[1][1] * rhs[2] - rhs[1] * a[2][1])
+                      - a[0][1] * (a[1][0] * rhs[2] - rhs[1] * a[2][0])
+                      + rhs[0] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]));
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef SPECTRAL_LUT_H
+#define SPECTRAL_LUT_H
+
+#include "spectrum.h"
+#include "../helpers/mapped_file.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// On-disk RGB to spectrum coefficient table. The file is a 64 byte header
+// followed by the flattened table spectrum uses, four floats per grid point
+// with red varying slowest, so it can be mapped and used in place. All
+// processes on a machine then share the same pages.
+//
+// Files without the header hold the table as vec3 doubles. They are still
+// read, into a private copy, and rewritten in this format.
+class spectral_lut {
+  public:
+    static constexpr const char* FILE_NAME = "lookup_table.bin";
+    static constexpr uint32_t VERSION = 1;
+
+    struct header {
+        char magic[4];              // "RLUT"
+        uint32_t version;
+        float step;                 // Grid spacing in the unit RGB cube
+        uint32_t size;              // Grid points per axis
+        uint32_t channels;          // Floats per grid point
+        int32_t observer;           // observer::standard_observer the table was fitted with
+        int32_t color_space;        // color::ColorSpace of the RGB axes
+        float start_wavelength;     // Wavelength range the polynomials are normalised to
+        float end_wavelength;
+        uint32_t unused;
+        uint64_t checksum;          // Of the table that follows
+        uint32_t reserved[4];
+    };
+    static_assert(sizeof(header) == 64, "The table must start 64 bytes into the file");
+
+    // Directories searched for the table: the ones given on the command
+    // line, then RAYDAR_LUT_PATH, then the working directory
+    static std::vector<std::string> search_path(const std::string& lut_path) {
+        std::vector<std::string> directories = split(lut_path);
+        const char* env = std::getenv("RAYDAR_LUT_PATH");
+        if (env) {
+            std::vector<std::string> more = split(env);
+            directories.insert(directories.end(), more.begin(), more.end());
+        }
+        directories.push_back(".");
+        return directories;
+    }
+
+    // Maps the first usable table in the search path and installs it in
+    // spectrum. Legacy tables are converted on the way.
+    static bool load(const std::vector<std::string>& directories, float step) {
+        for (const std::string& directory : directories) {
+            std::string path = join(directory, FILE_NAME);
+            std::ifstream probe(path, std::ios::binary);
+            if (!probe.good())
+                continue;
+            char magic[4] = {};
+            probe.read(magic, sizeof(magic));
+            probe.close();
+
+            if (std::memcmp(magic, "RLUT", 4) == 0) {
+                if (map(path, step))
+                    return true;
+                continue;
+            }
+            std::vector<vec3> legacy = read_legacy(path, step);
+            if (legacy.empty())
+                continue;
+            std::cout << "Converting legacy lookup table " << path << std::endl;
+            if (save(path, legacy, step) && map(path, step))
+                return true;
+            spectrum::setLookupTable(legacy, step);
+            return true;
+        }
+        return false;
+    }
+
+    // Writes the table next to the old one and renames it into place, so
+    // processes that have the old file mapped keep a consistent view
+    static bool save(const std::string& path, const std::vector<vec3>& table, float step) {
+        int size = grid_size(step);
+        if (table.size() != size_t(size) * size * size)
+            return false;
+        std::vector<float> data(table.size() * CHANNELS, 0.0f);
+        for (size_t i = 0; i < table.size(); ++i) {
+            data[i * CHANNELS + 0] = float(table[i].x());
+            data[i * CHANNELS + 1] = float(table[i].y());
+            data[i * CHANNELS + 2] = float(table[i].z());
+        }
+        header h = expected_header(step);
+        h.checksum = checksum(data.data(), data.size() * sizeof(float));
+
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::binary);
+            if (!out.is_open()) {
+                std::cerr << "Unable to write lookup table " << temporary << std::endl;
+                return false;
+            }
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+            if (!out.good()) {
+                std::cerr << "Unable to write lookup table " << temporary << std::endl;
+                return false;
+            }
+        }
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+            // Windows does not replace existing files when renaming
+            std::remove(path.c_str());
+            if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+                std::remove(temporary.c_str());
+                std::cerr << "Unable to replace lookup table " << path << std::endl;
+                return false;
+            }
+        }
+        std::cout << "Lookup table saved to " << path << std::endl;
+        return true;
+    }
+
+    // Saves to the first directory of the search path that can be written
+    static bool save(const std::vector<std::string>& directories, const std::vector<vec3>& table, float step) {
+        for (const std::string& directory : directories) {
+            if (save(join(directory, FILE_NAME), table, step))
+                return true;
+        }
+        return false;
+    }
+
+  private:
+    static constexpr int CHANNELS = 4;
+
+    static inline mapped_file mapping;
+
+    static bool map(const std::string& path, float step) {
+        mapped_file file;
+        if (!file.open(path)) {
+            std::cerr << "Unable to map lookup table " << path << std::endl;
+            return false;
+        }
+        std::string problem = validate(file, step);
+        if (!problem.empty()) {
+            std::cerr << "Skipping lookup table " << path << ": " << problem << std::endl;
+            return false;
+        }
+        mapping.swap(file);
+        const float* table = reinterpret_cast<const float*>(mapping.data() + sizeof(header));
+        spectrum::setLookupTable(table, grid_size(step), step);
+        std::cout << "Lookup table mapped from " << path << std::endl;
+        return true;
+    }
+
+    static std::string validate(const mapped_file& file, float step) {
+        if (file.size() < sizeof(header))
+            return "truncated header";
+        header h;
+        std::memcpy(&h, file.data(), sizeof(h));
+        header expected = expected_header(step);
+        if (h.version != VERSION)
+            return "unsupported version " + std::to_string(h.version);
+        if (h.step != expected.step || h.size != expected.size || h.channels != expected.channels)
+            return "grid step " + std::to_string(h.step) + " does not match";
+        if (h.observer != expected.observer || h.color_space != expected.color_space)
+            return "fitted for another observer or colour space";
+        if (h.start_wavelength != expected.start_wavelength || h.end_wavelength != expected.end_wavelength)
+            return "fitted for " + std::to_string(int(h.start_wavelength)) + "-" + std::to_string(int(h.end_wavelength)) + "nm";
+        size_t payload = size_t(h.size) * h.size * h.size * h.channels * sizeof(float);
+        if (file.size() != sizeof(header) + payload)
+            return "size does not match the header";
+        if (checksum(file.data() + sizeof(header), payload) != h.checksum)
+            return "checksum mismatch";
+        return "";
+    }
+
+    static header expected_header(float step) {
+        header h = {};
+        std::memcpy(h.magic, "RLUT", 4);
+        h.version = VERSION;
+        h.step = step;
+        h.size = uint32_t(grid_size(step));
+        h.channels = CHANNELS;
+        h.observer = observer::CIE1931_2Deg;
+        h.color_space = color::RGB_LIN;
+        h.start_wavelength = spectrum::START_WAVELENGTH;
+        h.end_wavelength = spectrum::END_WAVELENGTH;
+        return h;
+    }
+
+    static int grid_size(float step) {
+        return static_cast<int>(1.0f / step + 0.5f) + 1;
+    }
+
+    // FNV-1a over 64 bit words, enough to catch truncated or damaged files
+    static uint64_t checksum(const void* data, size_t bytes) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        uint64_t hash = 0xcbf29ce484222325ull;
+        size_t i = 0;
+        for (; i + 8 <= bytes; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, p + i, 8);
+            hash = (hash ^ word) * 0x100000001b3ull;
+        }
+        for (; i < bytes; ++i)
+            hash = (hash ^ p[i]) * 0x100000001b3ull;
+        return hash;
+    }
+
+    static std::vector<vec3> read_legacy(const std::string& path, float step) {
+        int size = grid_size(step);
+        std::vector<vec3> table(size_t(size) * size * size);
+        std::ifstream in(path, std::ios::binary);
+        in.read(reinterpret_cast<char*>(table.data()), table.size() * sizeof(vec3));
+        if (in.gcount() != std::streamsize(table.size() * sizeof(vec3)) || in.peek() != EOF) {
+            std::cerr << "Skipping lookup table " << path << ": neither versioned nor a legacy table of this size" << std::endl;
+            return {};
+        }
+        return table;
+    }
+
+    static std::vector<std::string> split(const std::string& list) {
+#ifdef _WIN32
+        const char separator = ';';
+#else
+        const char separator = ':';
+#endif
+        std::vector<std::string> parts;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(separator, start);
+            if (end == std::string::npos)
+                end = list.size();
+            if (end > start)
+                parts.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return parts;
+    }
+
+    static std::string join(const std::string& directory, const std::string& name) {
+        if (directory.empty() || directory.back() == '/' || directory.back() == '\\')
+            return directory + name;
+        return directory + "/" + name;
+    }
+};
+
+#endif
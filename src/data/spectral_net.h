@@ -0,0 +1,253 @@
+#ifndef SPECTRAL_NET_H
+#define SPECTRAL_NET_H
+
+#include "spectrum.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Inference for the SpectralNet model trained by assets/train_spectral.py,
+// an MLP taking XYZ (Y = 1 for a perfect white reflector) to a sampled
+// reflectance spectrum through ReLU hidden layers.
+//
+// Weights come from the binary export_weights writes:
+//   header   "RSNT", version, layer count, output scale, first and last
+//            output wavelength
+//   layers   inputs, outputs, weights as outputs x inputs, biases
+// all little-endian uint32 and float32.
+//
+// Colours are evaluated in batches. Every layer is a GEMM whose weights are
+// stored transposed and padded to whole SIMD lanes, so four colours at a
+// time share each weight load.
+class spectral_net {
+  public:
+    static constexpr uint32_t VERSION = 1;
+
+    bool load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) {
+            std::cerr << "Unable to open spectral model " << path << std::endl;
+            return false;
+        }
+        char magic[4];
+        uint32_t version = 0, layer_count = 0;
+        float scale = 1.0f, start = 0.0f, end = 0.0f;
+        in.read(magic, 4);
+        read(in, version);
+        read(in, layer_count);
+        read(in, scale);
+        read(in, start);
+        read(in, end);
+        if (!in.good() || std::memcmp(magic, "RSNT", 4) != 0 || version != VERSION || layer_count == 0 || layer_count > 16) {
+            std::cerr << "Not a spectral model: " << path << std::endl;
+            return false;
+        }
+
+        std::vector<layer> loaded(layer_count);
+        uint32_t previous_outputs = 3;
+        for (layer& l : loaded) {
+            uint32_t inputs = 0, outputs = 0;
+            read(in, inputs);
+            read(in, outputs);
+            if (!in.good() || inputs != previous_outputs || outputs == 0 || outputs > 4096) {
+                std::cerr << "Malformed spectral model: " << path << std::endl;
+                return false;
+            }
+            std::vector<float> weights(size_t(outputs) * inputs), biases(outputs);
+            in.read(reinterpret_cast<char*>(weights.data()), weights.size() * sizeof(float));
+            in.read(reinterpret_cast<char*>(biases.data()), biases.size() * sizeof(float));
+            if (!in.good()) {
+                std::cerr << "Truncated spectral model: " << path << std::endl;
+                return false;
+            }
+            l.inputs = int(inputs);
+            l.outputs = int(outputs);
+            l.stride = padded(l.outputs);
+            l.weights.assign(size_t(l.inputs) * l.stride, 0.0f);
+            l.biases.assign(l.stride, 0.0f);
+            for (int o = 0; o < l.outputs; ++o) {
+                for (int i = 0; i < l.inputs; ++i)
+                    l.weights[size_t(i) * l.stride + o] = weights[size_t(o) * l.inputs + i];
+                l.biases[o] = biases[o];
+            }
+            previous_outputs = outputs;
+        }
+        if (previous_outputs < 2) {
+            std::cerr << "Spectral model needs at least two output samples: " << path << std::endl;
+            return false;
+        }
+
+        layers = std::move(loaded);
+        output_scale = scale;
+        start_wavelength = start;
+        end_wavelength = end;
+        widest = 0;
+        for (const layer& l : layers)
+            widest = std::max(widest, l.stride);
+        // XYZ of the linear RGB primaries, the same matrix color::to_xyz uses
+        for (int column = 0; column < 3; ++column) {
+            color primary(column == 0, column == 1, column == 2, color::RGB_LIN);
+            color xyz = primary.to_xyz();
+            for (int row = 0; row < 3; ++row)
+                rgb_to_xyz[row][column] = float(xyz[row]);
+        }
+        return true;
+    }
+
+    int output_samples() const {
+        return layers.empty() ? 0 : layers.back().outputs;
+    }
+
+    // Spectra of count XYZ triples, output_samples() floats each
+    void forward(const float* xyz, int count, float* spectra) const {
+        std::vector<float> a(size_t(BATCH) * widest), b(size_t(BATCH) * widest);
+        const int outputs = output_samples();
+        for (int first = 0; first < count; first += BATCH) {
+            int rows = std::min(BATCH, count - first);
+            const float* input = xyz + size_t(first) * 3;
+            int input_stride = 3;
+            float* current = a.data();
+            for (size_t l = 0; l < layers.size(); ++l) {
+                gemm(layers[l], input, input_stride, rows, current, l + 1 < layers.size());
+                input = current;
+                input_stride = layers[l].stride;
+                current = current == a.data() ? b.data() : a.data();
+            }
+            for (int r = 0; r < rows; ++r) {
+                float* out = spectra + size_t(first + r) * outputs;
+                for (int o = 0; o < outputs; ++o)
+                    out[o] = std::max(input[size_t(r) * input_stride + o] * output_scale, 0.0f);
+            }
+        }
+    }
+
+    // Uplifts linear RGB colours to spectra at the build's wavelengths
+    void to_spectra(const color* rgb, int count, spectrum* out) const {
+        std::vector<float> xyz(size_t(count) * 3);
+        for (int i = 0; i < count; ++i) {
+            for (int row = 0; row < 3; ++row)
+                xyz[size_t(i) * 3 + row] = rgb_to_xyz[row][0] * float(rgb[i].x()) + rgb_to_xyz[row][1] * float(rgb[i].y()) + rgb_to_xyz[row][2] * float(rgb[i].z());
+        }
+        const int outputs = output_samples();
+        std::vector<float> spectra(size_t(count) * outputs);
+        forward(xyz.data(), count, spectra.data());
+        for (int i = 0; i < count; ++i)
+            out[i] = spectrum::resampled(spectra.data() + size_t(i) * outputs, outputs, start_wavelength, end_wavelength);
+    }
+
+    // The installed model, or nullptr while colours go through the sigmoid
+    // lookup table
+    static const spectral_net* active() {
+        return installed().layers.empty() ? nullptr : &installed();
+    }
+    static bool use(const std::string& path) {
+        spectral_net net;
+        if (!net.load(path))
+            return false;
+        installed() = std::move(net);
+        std::cout << "Uplifting colours with spectral model " << path << std::endl;
+        return true;
+    }
+
+    // Uplift through the active model, or the lookup table without one
+    static spectrum uplift(const color& rgb) {
+        spectrum s;
+        uplift(&rgb, 1, &s);
+        return s;
+    }
+    static void uplift(const color* rgb, int count, spectrum* out) {
+        if (const spectral_net* net = active()) {
+            net->to_spectra(rgb, count, out);
+            return;
+        }
+        for (int i = 0; i < count; ++i)
+            out[i] = spectrum(rgb[i]);
+    }
+
+  private:
+    // Colours per pass through the layers, small enough that the
+    // activations stay in L1/L2
+    static constexpr int BATCH = 64;
+
+    struct layer {
+        int inputs = 0;
+        int outputs = 0;
+        int stride = 0;                 // outputs rounded up to whole lanes
+        std::vector<float> weights;     // inputs x stride, transposed
+        std::vector<float> biases;      // stride
+    };
+
+    std::vector<layer> layers;
+    float output_scale = 1.0f;
+    float start_wavelength = 400.0f;
+    float end_wavelength = 700.0f;
+    int widest = 0;
+    float rgb_to_xyz[3][3] = {};
+
+    static spectral_net& installed() {
+        static spectral_net net;
+        return net;
+    }
+
+    template <typename T>
+    static void read(std::ifstream& in, T& value) {
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    static int padded(int count) {
+        return (count + spectrum_simd::WIDTH - 1) / spectrum_simd::WIDTH * spectrum_simd::WIDTH;
+    }
+
+    // out = act(in W + b) for rows colours, register blocked four rows by
+    // one lane of outputs
+    static void gemm(const layer& l, const float* in, int in_stride, int rows, float* out, bool relu) {
+        const spectrum_simd::lane zero = spectrum_simd::set1(0.0f);
+        int r = 0;
+        for (; r + 4 <= rows; r += 4) {
+            const float* in0 = in + size_t(r) * in_stride;
+            const float* in1 = in0 + in_stride;
+            const float* in2 = in1 + in_stride;
+            const float* in3 = in2 + in_stride;
+            for (int o = 0; o < l.stride; o += spectrum_simd::WIDTH) {
+                spectrum_simd::lane bias = spectrum_simd::loadu(l.biases.data() + o);
+                spectrum_simd::lane acc0 = bias, acc1 = bias, acc2 = bias, acc3 = bias;
+                const float* w = l.weights.data() + o;
+                for (int i = 0; i < l.inputs; ++i, w += l.stride) {
+                    spectrum_simd::lane wi = spectrum_simd::loadu(w);
+                    acc0 = spectrum_simd::fmadd(spectrum_simd::set1(in0[i]), wi, acc0);
+                    acc1 = spectrum_simd::fmadd(spectrum_simd::set1(in1[i]), wi, acc1);
+                    acc2 = spectrum_simd::fmadd(spectrum_simd::set1(in2[i]), wi, acc2);
+                    acc3 = spectrum_simd::fmadd(spectrum_simd::set1(in3[i]), wi, acc3);
+                }
+                if (relu) {
+                    acc0 = spectrum_simd::max(acc0, zero);
+                    acc1 = spectrum_simd::max(acc1, zero);
+                    acc2 = spectrum_simd::max(acc2, zero);
+                    acc3 = spectrum_simd::max(acc3, zero);
+                }
+                float* dst = out + size_t(r) * l.stride + o;
+                spectrum_simd::storeu(dst, acc0);
+                spectrum_simd::storeu(dst + l.stride, acc1);
+                spectrum_simd::storeu(dst + 2 * l.stride, acc2);
+                spectrum_simd::storeu(dst + 3 * l.stride, acc3);
+            }
+        }
+        for (; r < rows; ++r) {
+            const float* in0 = in + size_t(r) * in_stride;
+            for (int o = 0; o < l.stride; o += spectrum_simd::WIDTH) {
+                spectrum_simd::lane acc = spectrum_simd::loadu(l.biases.data() + o);
+                const float* w = l.weights.data() + o;
+                for (int i = 0; i < l.inputs; ++i, w += l.stride)
+                    acc = spectrum_simd::fmadd(spectrum_simd::set1(in0[i]), spectrum_simd::loadu(w), acc);
+                if (relu)
+                    acc = spectrum_simd::max(acc, zero);
+                spectrum_simd::storeu(out + size_t(r) * l.stride + o, acc);
+            }
+        }
+    }
+};
+
+#endif
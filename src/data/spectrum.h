@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <array>
+#include <cstdint>
 #include <cmath>
 #include <algorithm>
 #include <stdexcept>
@@ -13,6 +14,104 @@
 #include <fstream>
 #include <iostream>
 #include "color.h"
+#include "../helpers/fast_math.h"
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Lane type for spectrum arithmetic: 8 floats with AVX2, 4 with SSE2 and
+// plain floats elsewhere
+namespace spectrum_simd {
+#if defined(__AVX2__)
+    constexpr int WIDTH = 8;
+    using lane = __m256;
+    inline lane load(const float* p) { return _mm256_load_ps(p); }
+    inline lane loadu(const float* p) { return _mm256_loadu_ps(p); }
+    inline void store(float* p, lane v) { _mm256_store_ps(p, v); }
+    inline void storeu(float* p, lane v) { _mm256_storeu_ps(p, v); }
+    inline lane set1(float v) { return _mm256_set1_ps(v); }
+    inline lane add(lane a, lane b) { return _mm256_add_ps(a, b); }
+    inline lane sub(lane a, lane b) { return _mm256_sub_ps(a, b); }
+    inline lane mul(lane a, lane b) { return _mm256_mul_ps(a, b); }
+    inline lane div(lane a, lane b) { return _mm256_div_ps(a, b); }
+    inline lane fmadd(lane a, lane b, lane c) { return _mm256_fmadd_ps(a, b, c); }
+    inline lane max(lane a, lane b) { return _mm256_max_ps(a, b); }
+    inline float reduce(lane v) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    constexpr int WIDTH = 4;
+    using lane = __m128;
+    inline lane load(const float* p) { return _mm_load_ps(p); }
+    inline lane loadu(const float* p) { return _mm_loadu_ps(p); }
+    inline void store(float* p, lane v) { _mm_store_ps(p, v); }
+    inline void storeu(float* p, lane v) { _mm_storeu_ps(p, v); }
+    inline lane set1(float v) { return _mm_set1_ps(v); }
+    inline lane add(lane a, lane b) { return _mm_add_ps(a, b); }
+    inline lane sub(lane a, lane b) { return _mm_sub_ps(a, b); }
+    inline lane mul(lane a, lane b) { return _mm_mul_ps(a, b); }
+    inline lane div(lane a, lane b) { return _mm_div_ps(a, b); }
+    inline lane fmadd(lane a, lane b, lane c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    inline lane max(lane a, lane b) { return _mm_max_ps(a, b); }
+    inline float reduce(lane v) {
+        __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+#else
+    constexpr int WIDTH = 1;
+    using lane = float;
+    inline lane load(const float* p) { return *p; }
+    inline lane loadu(const float* p) { return *p; }
+    inline void store(float* p, lane v) { *p = v; }
+    inline void storeu(float* p, lane v) { *p = v; }
+    inline lane set1(float v) { return v; }
+    inline lane add(lane a, lane b) { return a + b; }
+    inline lane sub(lane a, lane b) { return a - b; }
+    inline lane mul(lane a, lane b) { return a * b; }
+    inline lane div(lane a, lane b) { return a / b; }
+    inline lane fmadd(lane a, lane b, lane c) { return a * b + c; }
+    inline lane max(lane a, lane b) { return a > b ? a : b; }
+    inline float reduce(lane v) { return v; }
+#endif
+}
+
+// Spectral layout of the build, set through the RAYDAR_SPECTRAL_* CMake
+// cache variables, e.g. 16 samples for look-dev or 64 from 380 to 780nm for
+// colour-critical finals
+#ifndef RAYDAR_SPECTRAL_SAMPLES
+#define RAYDAR_SPECTRAL_SAMPLES 31
+#endif
+#ifndef RAYDAR_SPECTRAL_START
+#define RAYDAR_SPECTRAL_START 400
+#endif
+#ifndef RAYDAR_SPECTRAL_END
+#define RAYDAR_SPECTRAL_END 700
+#endif
+
+// Counts of spectrum arithmetic, built in with the RAYDAR_SPECTRUM_STATS
+// CMake option and reported after each render
+#ifdef RAYDAR_SPECTRUM_STATS
+#include <atomic>
+struct spectrum_stats {
+    std::atomic<uint64_t> sampled_ops{0};   // Passes over every sample
+
+    static spectrum_stats& get() {
+        static spectrum_stats stats;
+        return stats;
+    }
+    void reset() {
+        sampled_ops = 0;
+    }
+    void report(std::ostream& os) const {
+        os << "Spectrum operations: " << sampled_ops << " passes over every sample" << std::endl;
+    }
+};
+#define RAYDAR_SPECTRUM_COUNT(counter) spectrum_stats::get().counter.fetch_add(1, std::memory_order_relaxed)
+#else
+#define RAYDAR_SPECTRUM_COUNT(counter) ((void)0)
+#endif
 
 class observer {
 public:
@@ -27,7 +126,11 @@ public:
         CIE2006_10Deg
     };
     observer(enum standard_observer stdobs, int samples, double start, double end) {
-
+        int length = 0;
+        const double* wavelengths = nullptr;
+        const double* x_bar = nullptr;
+        const double* y_bar = nullptr;
+        const double* z_bar = nullptr;
         switch (stdobs) {
             case CIE1931_2Deg:
                 length = 471;
@@ -96,86 +199,131 @@ public:
             default:
                 break;
         }
-        interpolateXYZSimple(samples, start, end);
+        interpolateXYZ(wavelengths, x_bar, y_bar, z_bar, length, samples, start, end);
+        build_weights();
     }
-    const int get_length() const {
-        return length;
+
+    // Observer for the spectral layout of the build. All of them are built
+    // once on first use and never change, so the pointer can be shared.
+    static const observer* get(enum standard_observer stdobs) {
+        static const std::vector<observer> shared = [] {
+            std::vector<observer> all;
+            all.reserve(CIE2006_10Deg + 1);
+            for (int i = 0; i <= CIE2006_10Deg; ++i)
+                all.emplace_back(standard_observer(i), RAYDAR_SPECTRAL_SAMPLES, RAYDAR_SPECTRAL_START, RAYDAR_SPECTRAL_END);
+            return all;
+        }();
+        return &shared[stdobs];
     }
-    double* wavelengths;
-    double* x_bar;
-    double* y_bar;
-    double* z_bar;
-    
+
+    int get_length() const {
+        return int(wavelengths_.size());
+    }
+
+    // Rows of the 3 x N matrix taking samples to XYZ, already divided by the
+    // integral of y_bar. The last sample is left out of the integral, as it
+    // always has been, so rows only have get_length() - 1 entries.
+    const float* weights(int row) const {
+        return weights_.data() + row * weight_count();
+    }
+    int weight_count() const {
+        return get_length() - 1;
+    }
+
+    color to_XYZ(const float* samples) const {
+        float xyz[3];
+        integrate(samples, xyz);
+        return color(xyz[0], xyz[1], xyz[2], color::ColorSpace::XYZ);
+    }
+    // XYZ of count spectra lying stride floats apart, e.g. a scanline of an
+    // image, written as consecutive triples to xyz
+    void to_XYZ(const float* samples, int stride, int count, float* xyz) const {
+        for (int i = 0; i < count; ++i)
+            integrate(samples + i * stride, xyz + i * 3);
+    }
+
     private:
-        int length;
-        void interpolateXYZSimple(int numSamples, double startWavelength, double endWavelength) {
-            std::vector<double> newWavelengths(numSamples);
-            std::vector<double> newX(numSamples);
-            std::vector<double> newY(numSamples);
-            std::vector<double> newZ(numSamples);
-            // length is already a member variable, so we don't need to redefine it here
-            // wavelengths is a double*, so we can't use .size() on it
-            // We'll use the existing length member variable instead
-            double step = (endWavelength - startWavelength) / (numSamples - 1);
-            for (int i = 0; i < numSamples; ++i) {
-                newWavelengths[i] = startWavelength + i * step;
-                for (int j = 0; j < length; j++) {
-                    if( int(newWavelengths[i]) == int(wavelengths[j])) {
-                        newX[i] = x_bar[j];
-                        newY[i] = y_bar[j];
-                        newZ[i] = z_bar[j];
-                    }
-                }
+        std::vector<double> wavelengths_, x_bar_, y_bar_, z_bar_;
+        std::vector<float> weights_;
+
+        void build_weights() {
+            double norm = 0.0;
+            for (double y : y_bar_)
+                norm += y;
+            int n = weight_count();
+            weights_.assign(3 * n, 0.0f);
+            for (int i = 0; i < n; ++i) {
+                weights_[i] = float(x_bar_[i] / norm);
+                weights_[n + i] = float(y_bar_[i] / norm);
+                weights_[2 * n + i] = float(z_bar_[i] / norm);
             }
-            std::copy(newX.begin(), newX.end(), x_bar);
-            std::copy(newY.begin(), newY.end(), y_bar);
-            std::copy(newZ.begin(), newZ.end(), z_bar);
-            length = numSamples;
         }
-        void interpolateXYZ(int numSamples, double startWavelength, double endWavelength) {
-            if (numSamples <= 0 || startWavelength >= endWavelength) {
-                return;  // Invalid input, do nothing
-            }
 
-            std::vector<double> newWavelengths(numSamples);
-            std::vector<double> newX(numSamples);
-            std::vector<double> newY(numSamples);
-            std::vector<double> newZ(numSamples);
+        // Dot products of the samples with the three weight rows
+        void integrate(const float* samples, float* xyz) const {
+            const int n = weight_count();
+            const float* wx = weights(0);
+            const float* wy = weights(1);
+            const float* wz = weights(2);
+            spectrum_simd::lane x = spectrum_simd::set1(0.0f);
+            spectrum_simd::lane y = x;
+            spectrum_simd::lane z = x;
+            int i = 0;
+            for (; i + spectrum_simd::WIDTH <= n; i += spectrum_simd::WIDTH) {
+                spectrum_simd::lane s = spectrum_simd::loadu(samples + i);
+                x = spectrum_simd::fmadd(s, spectrum_simd::loadu(wx + i), x);
+                y = spectrum_simd::fmadd(s, spectrum_simd::loadu(wy + i), y);
+                z = spectrum_simd::fmadd(s, spectrum_simd::loadu(wz + i), z);
+            }
+            xyz[0] = spectrum_simd::reduce(x);
+            xyz[1] = spectrum_simd::reduce(y);
+            xyz[2] = spectrum_simd::reduce(z);
+            for (; i < n; ++i) {
+                xyz[0] += samples[i] * wx[i];
+                xyz[1] += samples[i] * wy[i];
+                xyz[2] += samples[i] * wz[i];
+            }
+        }
 
-            double step = (endWavelength - startWavelength) / (numSamples - 1);
+        void interpolateXYZ(const double* wavelengths, const double* x_bar, const double* y_bar, const double* z_bar, int length,
+                            int numSamples, double startWavelength, double endWavelength) {
+            if (numSamples <= 1 || startWavelength >= endWavelength) {
+                throw std::invalid_argument("Observer needs at least two samples over a non-empty range");
+            }
 
-            
+            wavelengths_.resize(numSamples);
+            x_bar_.resize(numSamples);
+            y_bar_.resize(numSamples);
+            z_bar_.resize(numSamples);
 
+            double step = (endWavelength - startWavelength) / (numSamples - 1);
             for (int i = 0; i < numSamples; ++i) {
-                double wavelength = newWavelengths[i];
-                
-                // Find the two nearest points in the original data
-                auto it = std::lower_bound(wavelengths, wavelengths + length, wavelength);
-                int index = std::distance(wavelengths, it);
+                double wavelength = startWavelength + i * step;
+                wavelengths_[i] = wavelength;
 
-                if (index == 0) {
-
-                    newX[i] = x_bar[0];
-                    newY[i] = y_bar[0];
-                    newZ[i] = z_bar[0];
+                // Find the two nearest points in the original data
+                const double* it = std::lower_bound(wavelengths, wavelengths + length, wavelength);
+                int index = int(it - wavelengths);
+
+                if (index < length && wavelengths[index] == wavelength) {
+                    x_bar_[i] = x_bar[index];
+                    y_bar_[i] = y_bar[index];
+                    z_bar_[i] = z_bar[index];
+                } else if (index == 0) {
+                    x_bar_[i] = x_bar[0];
+                    y_bar_[i] = y_bar[0];
+                    z_bar_[i] = z_bar[0];
                 } else if (index == length) {
-                    newX[i] = x_bar[length - 1];
-                    newY[i] = y_bar[length - 1];
-                    newZ[i] = z_bar[length - 1];
+                    x_bar_[i] = x_bar[length - 1];
+                    y_bar_[i] = y_bar[length - 1];
+                    z_bar_[i] = z_bar[length - 1];
                 } else {
                     double t = (wavelength - wavelengths[index - 1]) / (wavelengths[index] - wavelengths[index - 1]);
-                    newX[i] = x_bar[index - 1] + t * (x_bar[index] - x_bar[index - 1]);
-                    newY[i] = y_bar[index - 1] + t * (y_bar[index] - y_bar[index - 1]);
-                    newZ[i] = z_bar[index - 1] + t * (z_bar[index] - z_bar[index - 1]);
+                    x_bar_[i] = x_bar[index - 1] + t * (x_bar[index] - x_bar[index - 1]);
+                    y_bar_[i] = y_bar[index - 1] + t * (y_bar[index] - y_bar[index - 1]);
+                    z_bar_[i] = z_bar[index - 1] + t * (z_bar[index] - z_bar[index - 1]);
                 }
             }
-
-            // Overwrite the original arrays with the new interpolated values
-            length = numSamples;
-            std::copy(newWavelengths.begin(), newWavelengths.end(), wavelengths);
-            std::copy(newX.begin(), newX.end(), x_bar);
-            std::copy(newY.begin(), newY.end(), y_bar);
-            std::copy(newZ.begin(), newZ.end(), z_bar);
         }
         // CIE 1931 2-deg, XYZ CMFs
         // http://cvrl.ioo.ucl.ac.uk/cmfs.htm
@@ -237,119 +385,95 @@ public:
 
 class spectrum {
 public:
-    static constexpr int RESPONSE_SAMPLES = 31; // 1nm resolution from 380nm to 740nm
-    static constexpr float START_WAVELENGTH = 400.0f;
-    static constexpr float END_WAVELENGTH = 700.0f;
-    static void setLookupTable(const std::vector<std::vector<std::vector<vec3>>>& table, float step = 0.01f) { spectrum::lookup_table = table; spectrum::step = step; }
-    static const std::vector<std::vector<std::vector<vec3>>>& getLookupTable() { return lookup_table; }
-
-    spectrum() : data_(RESPONSE_SAMPLES) {}
-    spectrum(const std::vector<float>& data) : data_(data) { }
-    spectrum(const float* data) : data_(data, data + RESPONSE_SAMPLES) {}
-    spectrum(float r, float g, float b, float coeff_a, float coeff_b, float coeff_c) : data_(RESPONSE_SAMPLES) {
-        // Convert RGB to XYZ
-        data_ = std::vector<float>(RESPONSE_SAMPLES);
-        for(int i = 0; i < RESPONSE_SAMPLES; i++){
-            data_[i] = spectrum_function(START_WAVELENGTH + i * (END_WAVELENGTH - START_WAVELENGTH) / RESPONSE_SAMPLES, coeff_a, coeff_b, coeff_c);
+    static constexpr int RESPONSE_SAMPLES = RAYDAR_SPECTRAL_SAMPLES;
+    static constexpr float START_WAVELENGTH = float(RAYDAR_SPECTRAL_START);
+    static constexpr float END_WAVELENGTH = float(RAYDAR_SPECTRAL_END);
+    static_assert(RESPONSE_SAMPLES >= 2, "A spectrum needs at least two samples");
+    static_assert(START_WAVELENGTH < END_WAVELENGTH, "The spectral range must not be empty");
+    // Takes the coefficients of every grid point in the RGB cube, with red
+    // varying slowest, and flattens them to four floats per point
+    static void setLookupTable(const std::vector<vec3>& table, float step = 0.01f) {
+        int size = static_cast<int>(1.0f / step + 0.5f) + 1;
+        if (size < 2 || table.size() != size_t(size) * size * size) {
+            std::cerr << "Error: Lookup table does not match its step" << std::endl;
+            return;
         }
+        coefficient_table.assign(table.size() * 4, 0.0f);
+        for (size_t i = 0; i < table.size(); ++i) {
+            coefficient_table[i * 4 + 0] = float(table[i].x());
+            coefficient_table[i * 4 + 1] = float(table[i].y());
+            coefficient_table[i * 4 + 2] = float(table[i].z());
+        }
+        use_coefficients(coefficient_table.data(), size, step);
     }
-    spectrum(float r, float g, float b) : spectrum(color(r, g, b, color::ColorSpace::RGB_LIN)) {}
-    spectrum(color c)
-        : data_(RESPONSE_SAMPLES) {
+    // Uses a flattened table owned elsewhere, e.g. a mapped file, without
+    // copying it. The table has to outlive every spectrum constructed from RGB.
+    static void setLookupTable(const float* table, int size, float step) {
+        if (table != coefficient_table.data())
+            std::vector<float>().swap(coefficient_table);
+        use_coefficients(table, size, step);
+    }
+
+    // Samples are stored inline, padded to a whole number of SIMD lanes. The
+    // padding is kept at zero by everything except division, and reductions
+    // never read it.
+    static constexpr int PADDED_SAMPLES = (RESPONSE_SAMPLES + 7) / 8 * 8;
+
+    // Read-only view of the samples, in place of the vector they used to live in
+    class sample_view {
+      public:
+        explicit sample_view(const float* samples) : samples(samples) {}
+        const float* data() const { return samples; }
+        size_t size() const { return RESPONSE_SAMPLES; }
+        bool empty() const { return false; }
+        const float* begin() const { return samples; }
+        const float* end() const { return samples + RESPONSE_SAMPLES; }
+        const float& operator[](size_t index) const { return samples[index]; }
+      private:
+        const float* samples;
+    };
+
+    spectrum() : data_() {}
+    spectrum(const std::vector<float>& data) : data_() {
+        std::copy(data.begin(), data.begin() + std::min<size_t>(data.size(), RESPONSE_SAMPLES), data_);
+    }
+    spectrum(const float* data) : data_() {
+        std::copy(data, data + RESPONSE_SAMPLES, data_);
+    }
+    spectrum(float r, float g, float b, float coeff_a, float coeff_b, float coeff_c) : data_() {
         // Convert RGB to XYZ
+        from_coefficients(coeff_a, coeff_b, coeff_c);
+    }
+    spectrum(float r, float g, float b) : spectrum(color(r, g, b, color::ColorSpace::RGB_LIN)) {}
+    spectrum(color c) : spectrum(uninitialized_tag{}) {
         c.set_color_space(color::ColorSpace::RGB_LIN);
-        data_ = std::vector<float>(RESPONSE_SAMPLES);
-
-        vec3 rgb_coeffs;
-
-        int size = static_cast<int>(1.0f / spectrum::step + 0.5f) + 1;
-        float r_scaled = c.x() * (size - 1);
-        float g_scaled = c.y() * (size - 1);
-        float b_scaled = c.z() * (size - 1);
-
-        int r_index = std::min(static_cast<int>(r_scaled), size - 1);
-        int g_index = std::min(static_cast<int>(g_scaled), size - 1);
-        int b_index = std::min(static_cast<int>(b_scaled), size - 1);
-
-        float r_frac = r_scaled - r_index;
-        float g_frac = g_scaled - g_index;
-        float b_frac = b_scaled - b_index;
-
-        // Check if we need to interpolate
-        if (r_frac < 1e-6 && g_frac < 1e-6 && b_frac < 1e-6) {
-            // Exact match, no interpolation needed
-            rgb_coeffs = spectrum::lookup_table[r_index][g_index][b_index];
-        } else {
-            // Trilinear interpolation
-            vec3 c000 = spectrum::lookup_table[r_index][g_index][b_index];
-            vec3 c001 = (b_index < size - 1) ? spectrum::lookup_table[r_index][g_index][b_index + 1] : c000;
-            vec3 c010 = (g_index < size - 1) ? spectrum::lookup_table[r_index][g_index + 1][b_index] : c000;
-            vec3 c011 = (g_index < size - 1 && b_index < size - 1) ? spectrum::lookup_table[r_index][g_index + 1][b_index + 1] : c010;
-            vec3 c100 = (r_index < size - 1) ? spectrum::lookup_table[r_index + 1][g_index][b_index] : c000;
-            vec3 c101 = (r_index < size - 1 && b_index < size - 1) ? spectrum::lookup_table[r_index + 1][g_index][b_index + 1] : c100;
-            vec3 c110 = (r_index < size - 1 && g_index < size - 1) ? spectrum::lookup_table[r_index + 1][g_index + 1][b_index] : c100;
-            vec3 c111 = (r_index < size - 1 && g_index < size - 1 && b_index < size - 1) ? spectrum::lookup_table[r_index + 1][g_index + 1][b_index + 1] : c110;
-
-            vec3 c00 = c000 * (1 - r_frac) + c100 * r_frac;
-            vec3 c01 = c001 * (1 - r_frac) + c101 * r_frac;
-            vec3 c10 = c010 * (1 - r_frac) + c110 * r_frac;
-            vec3 c11 = c011 * (1 - r_frac) + c111 * r_frac;
-
-            vec3 c0 = c00 * (1 - g_frac) + c10 * g_frac;
-            vec3 c1 = c01 * (1 - g_frac) + c11 * g_frac;
-
-            rgb_coeffs = c0 * (1 - b_frac) + c1 * b_frac;
-        }
-
-        for (int i = 0; i < RESPONSE_SAMPLES; i++) {
-            float wavelength = START_WAVELENGTH + i * (END_WAVELENGTH - START_WAVELENGTH) / RESPONSE_SAMPLES;
-            data_[i] = spectrum_function(wavelength, rgb_coeffs.x(), rgb_coeffs.y(), rgb_coeffs.z());
-        }
+        float coeffs[4];
+        lookup_coefficients(float(c.x()), float(c.y()), float(c.z()), coeffs);
+        from_coefficients(coeffs[0], coeffs[1], coeffs[2]);
+    }
+    // Every sample set to value, for constant spectra that need no uplift
+    static spectrum uniform(float value) {
+        spectrum result(uninitialized_tag{});
+        std::fill(result.data_, result.data_ + RESPONSE_SAMPLES, value);
+        std::fill(result.data_ + RESPONSE_SAMPLES, result.data_ + PADDED_SAMPLES, 0.0f);
+        return result;
     }
     float& operator[](int index) { return data_[index]; }
     const float& operator[](int index) const { return data_[index]; }
     
-    int num_wavelengths() const { return static_cast<int>(data_.size()); }
+    int num_wavelengths() const { return RESPONSE_SAMPLES; }
 
-    color to_rgb( observer * observer) const {
+    color to_rgb(const observer * observer) const {
         color xyz = to_XYZ(observer);
         color rgb = xyz.to_rgb();
 
         return rgb;
     }
-    color to_XYZ( observer * observer) const {
-        color xyz;
-        
-        std::vector<double> x_bar(observer->get_length());
-        std::vector<double> y_bar(observer->get_length());
-        std::vector<double> z_bar(observer->get_length());
-
-        // Multiply spectrum by each cone fundamental
-        int i;
-        // Calculate the normalization factor for illuminant
-        double illuminant_norm = 0.0;
-        for (int i = 0; i < observer->get_length(); i++) {
-            illuminant_norm +=  observer->y_bar[i];// * d65_spd[i];
-        }
-        //illuminant_norm /= 16.0;
-
-        for(i = 0; i < observer->get_length()-1; i++){
-           
-            x_bar[i] = data_[i] * observer->x_bar[i];// * d65_spd[i];
-            y_bar[i] = data_[i] * observer->y_bar[i];// * d65_spd[i];
-            z_bar[i] = data_[i] * observer->z_bar[i];// * d65_spd[i];
-        }
-
-        // Integrate
-        // Normalize
-        double X = integrate(x_bar.data(), observer->get_length()) / illuminant_norm;
-        double Y = integrate(y_bar.data(), observer->get_length()) / illuminant_norm;
-        double Z = integrate(z_bar.data(), observer->get_length()) / illuminant_norm;
-
-        color result = color(X, Y, Z);
-        result.set_color_space(color::ColorSpace::XYZ);
-        return result;
+    color to_XYZ(const observer * observer) const {
+        return observer->to_XYZ(data_);
     }
+    // Coordinate descent fit of one colour. Tables come from spectral_fit;
+    // this stays as the reference raydar_lut --compare measures against.
     static vec3 find_coeff(float r, float g, float b, vec3 start_coeffs = {0.0, 0.0, 0.0}){
         #define LEARNING_RATE 0.0003
         #define SEARCH_TOLERANCE 0.0035
@@ -358,7 +482,7 @@ public:
         color target_rgb = color(r, g, b);
         target_rgb.set_color_space(color::ColorSpace::RGB_LIN);
 
-        observer * observer_ptr = new observer(observer::CIE1931_2Deg, 31, 400, 700);
+        const observer * observer_ptr = observer::get(observer::CIE1931_2Deg);
         for(int i = 0; i < MAX_ITERATIONS; i++){
             bool found = false;
             {
@@ -438,177 +562,94 @@ public:
         spectrum test_spectrum(r, g, b, coeffs.x(), coeffs.y(), coeffs.z());
         color current_rgb = test_spectrum.to_rgb(observer_ptr);
         std::cout << "Target RGB: " << target_rgb.x() << " " << target_rgb.y() << " " << target_rgb.z() << " Current RGB: " << current_rgb.x() << " " << current_rgb.y() << " " << current_rgb.z() << std::endl;
-        delete observer_ptr;
         return coeffs;
     }
-    static std::vector<vec3> compute_lookup_tables(float step = 0.01) {
-
-        const int size = static_cast<int>(1.0 / step + 0.5) + 1;  // Changed to include 1.0
-        const int total_size = size * size * size;
-        std::cout << "Computing lookup table with total size: " << total_size << std::endl;
-        std::vector<vec3> lookup_table(total_size, vec3(0.0, 0.0, 0.0));
-
-        
-
-        const int num_threads = std::thread::hardware_concurrency();
-        std::vector<std::thread> threads;
-
-        auto worker = [&](int start, int end) {
-            vec3 start_coeffs = {0.0, 0.0, 0.0};
-            for (int i = start; i < end; ++i) {
-                int r_index = i / (size * size);
-                int g_index = (i / size) % size;
-                int b_index = i % size;
-                
-                float R = r_index * step;
-                float G = g_index * step;
-                float B = b_index * step;
-                
-                // Ensure we don't exceed 1.0 due to floating point precision
-                R = std::min(R, 1.0f);
-                G = std::min(G, 1.0f);
-                B = std::min(B, 1.0f);
-
-                vec3 coeffs = find_coeff(R, G, B, start_coeffs);
-                lookup_table[i] = coeffs;
-            }
-        };
-
-        int chunk_size = total_size / num_threads;
-        for (int i = 0; i < num_threads; ++i) {
-            int start = i * chunk_size;
-            int end = (i == num_threads - 1) ? total_size : (i + 1) * chunk_size;
-            threads.emplace_back(worker, start, end);
-        }
-
-        for (auto& thread : threads) {
-            thread.join();
-        }
-
-        // Serialize the lookup table to a file
-        std::ofstream outfile("lookup_table.bin", std::ios::binary);
-        if (outfile.is_open()) {
-            outfile.write(reinterpret_cast<const char*>(lookup_table.data()), lookup_table.size() * sizeof(vec3));
-            outfile.close();
-            std::cout << "Lookup table serialized to lookup_table.bin" << std::endl;
-        } else {
-            std::cerr << "Unable to open file for writing" << std::endl;
-        }
-
-        return lookup_table;
-    }    
-    static std::vector<std::vector<std::vector<vec3>>> load_lookup_tables(float step = 0.01) {
-        const int size = static_cast<int>(1.0 / step + 0.5) + 1;
-        const int total_size = size * size * size;
-        std::cout << "Loading lookup table with dimensions: " << size << "x" << size << "x" << size << std::endl;
-        
-        std::ifstream infile("lookup_table.bin", std::ios::binary);
-        std::vector<std::vector<std::vector<vec3>>> lookup_table(size, std::vector<std::vector<vec3>>(size, std::vector<vec3>(size)));
-
-        if (infile.is_open()) {
-            for (int i = 0; i < size; ++i) {
-                for (int j = 0; j < size; ++j) {
-                    for (int k = 0; k < size; ++k) {
-                        infile.read(reinterpret_cast<char*>(&lookup_table[i][j][k]), sizeof(vec3));
-                    }
-                }
-            }
-            infile.close();
-
-            if (infile.gcount() == sizeof(vec3)) {
-                std::cout << "Lookup table loaded from lookup_table.bin" << std::endl;
-            } else {
-                std::cerr << "Error: Incomplete data in lookup_table.bin" << std::endl;
-                lookup_table.clear();
-            }
-        } else {
-            std::cerr << "Unable to open file for reading" << std::endl;
-        }
-
-        return lookup_table;
-    }
-
     spectrum& operator+=(const spectrum& v) {
-        for (size_t i = 0; i < data_.size(); ++i) {
-            data_[i] += v.data_[i];
-        }
-        return *this;
+        return apply<spectrum_simd::add>(v);
     }
     spectrum& operator-=(const spectrum& v) {
-        for (size_t i = 0; i < data_.size(); ++i) {
-            data_[i] -= v.data_[i];
-        }
-        return *this;
+        return apply<spectrum_simd::sub>(v);
     }
 
     spectrum& operator*=(double t) {
-        for (size_t i = 0; i < data_.size(); ++i) {
-            data_[i] *= t;
-        }
+        RAYDAR_SPECTRUM_COUNT(sampled_ops);
+        spectrum_simd::lane factor = spectrum_simd::set1(float(t));
+        for (int i = 0; i < PADDED_SAMPLES; i += spectrum_simd::WIDTH)
+            spectrum_simd::store(data_ + i, spectrum_simd::mul(spectrum_simd::load(data_ + i), factor));
         return *this;
     }
     spectrum& operator*=(const spectrum& v) {
-        for (size_t i = 0; i < data_.size(); ++i) {
-            data_[i] *= v.data_[i];
-        }
-        return *this;
+        return apply<spectrum_simd::mul>(v);
     }
     spectrum operator*(double t) const {
-        spectrum result = *this;
-        for (size_t i = 0; i < result.data_.size(); ++i) {
-            result.data_[i] *= t;
-        }
-        return result;
+        return scaled(*this, t);
     }
     spectrum operator/(double t) const {
-        spectrum result = *this;
-        for (size_t i = 0; i < result.data_.size(); ++i) {
-            result.data_[i] /= t;
-        }
-        return result;
+        return scaled(*this, 1 / t);
     }
     spectrum operator*(const spectrum& v) const {
-        spectrum result = *this;
-        for (size_t i = 0; i < result.data_.size(); ++i) {
-            result.data_[i] *= v.data_[i];
-        }
-        return result;
+        return combined<spectrum_simd::mul>(*this, v);
     }
     spectrum operator+(const spectrum& v) const {
-        spectrum result = *this;
-        for (size_t i = 0; i < result.data_.size(); ++i) {
-            result.data_[i] += v.data_[i];
-        }
-        return result;
+        return combined<spectrum_simd::add>(*this, v);
     }
     spectrum operator-(const spectrum& v) const {
-        spectrum result = *this;
-        for (size_t i = 0; i < result.data_.size(); ++i) {
-            result.data_[i] -= v.data_[i];
-        }
-        return result;
+        return combined<spectrum_simd::sub>(*this, v);
     }
     spectrum& operator/=(double t) {
         return *this *= 1/t;
     }
     spectrum& operator/=(const spectrum& v) {
-        for (size_t i = 0; i < data_.size(); ++i) {
-            data_[i] /= v.data_[i];
-        }
+        return apply<spectrum_simd::div>(v);
+    }
+
+    // this += a * b in one pass, fused where the hardware has it
+    spectrum& fmadd(const spectrum& a, const spectrum& b) {
+        RAYDAR_SPECTRUM_COUNT(sampled_ops);
+        for (int i = 0; i < PADDED_SAMPLES; i += spectrum_simd::WIDTH)
+            spectrum_simd::store(data_ + i, spectrum_simd::fmadd(spectrum_simd::load(a.data_ + i), spectrum_simd::load(b.data_ + i), spectrum_simd::load(data_ + i)));
+        return *this;
+    }
+    // this += a * t
+    spectrum& fmadd(const spectrum& a, double t) {
+        RAYDAR_SPECTRUM_COUNT(sampled_ops);
+        spectrum_simd::lane factor = spectrum_simd::set1(float(t));
+        for (int i = 0; i < PADDED_SAMPLES; i += spectrum_simd::WIDTH)
+            spectrum_simd::store(data_ + i, spectrum_simd::fmadd(spectrum_simd::load(a.data_ + i), factor, spectrum_simd::load(data_ + i)));
         return *this;
     }
 
+    // Horizontal sum over the samples, leaving out the padding
+    double sum() const {
+        const int last = PADDED_SAMPLES - spectrum_simd::WIDTH;
+        spectrum_simd::lane acc = spectrum_simd::set1(0.0f);
+        for (int i = 0; i < last; i += spectrum_simd::WIDTH)
+            acc = spectrum_simd::add(acc, spectrum_simd::load(data_ + i));
+        alignas(32) float lanes[spectrum_simd::WIDTH];
+        spectrum_simd::store(lanes, acc);
+        double result = 0.0;
+        for (int i = 0; i < spectrum_simd::WIDTH; ++i)
+            result += lanes[i];
+        for (int i = last; i < RESPONSE_SAMPLES; ++i)
+            result += data_[i];
+        return result;
+    }
+    // Largest sample
+    float max_value() const {
+        return *std::max_element(data_, data_ + RESPONSE_SAMPLES);
+    }
+
 
     float get_wavelength(int index) const {
-        if (index < 0 || index >= static_cast<int>(data_.size())) {
+        if (index < 0 || index >= RESPONSE_SAMPLES) {
             throw std::out_of_range("Index out of range");
         }
-        return START_WAVELENGTH + index * (END_WAVELENGTH - START_WAVELENGTH) / (data_.size() - 1);
+        return START_WAVELENGTH + index * (END_WAVELENGTH - START_WAVELENGTH) / (RESPONSE_SAMPLES - 1);
     }
 
     friend std::ostream& operator<<(std::ostream& os, const spectrum& s) {
         os << "Spectrum: [";
-        for (size_t i = 0; i < s.data_.size(); ++i) {
+        for (int i = 0; i < RESPONSE_SAMPLES; ++i) {
             if (i > 0) os << ", ";
             os << std::fixed << std::setprecision(4) << s.data_[i];
         }
@@ -617,50 +658,149 @@ public:
     }
 
     static spectrum d65(){
-        spectrum s;
-        for(int i = 0; i < RESPONSE_SAMPLES; i++){
-            s[i] = d65_spd[i];
-        }
-        return s;
+        static const spectrum illuminant = resampled(d65_spd, ILLUMINANT_SAMPLES, ILLUMINANT_START, ILLUMINANT_END);
+        return illuminant;
     }
     static spectrum d65_cb(){
-        spectrum s;
-        for(int i = 0; i < RESPONSE_SAMPLES; i++){
-            s[i] = d65_cb_spd[i];
-        }
-        return s;
+        static const spectrum illuminant = resampled(d65_cb_spd, ILLUMINANT_SAMPLES, ILLUMINANT_START, ILLUMINANT_END);
+        return illuminant;
     }
     static spectrum d50_cb(){
-        spectrum s;
-        for(int i = 0; i < RESPONSE_SAMPLES; i++){
-            s[i] = d50_cb_spd[i];
-        }
-        return s;
+        static const spectrum illuminant = resampled(d50_cb_spd, ILLUMINANT_SAMPLES, ILLUMINANT_START, ILLUMINANT_END);
+        return illuminant;
     }
     static spectrum d50(){
-        spectrum s;
-        for(int i = 0; i < RESPONSE_SAMPLES; i++){
-            s[i] = d50_spd[i];
-        }
-        return s;
+        static const spectrum illuminant = resampled(d50_spd, ILLUMINANT_SAMPLES, ILLUMINANT_START, ILLUMINANT_END);
+        return illuminant;
     }
     static spectrum studio_led(){
+        static const spectrum illuminant = resampled(studio_led_spd, ILLUMINANT_SAMPLES, ILLUMINANT_START, ILLUMINANT_END);
+        return illuminant;
+    }
+    // Linear interpolation of count samples spread evenly from start to end
+    // at the wavelengths of this build, holding the end samples outside them
+    template <typename T>
+    static spectrum resampled(const T* samples, int count, float start, float end) {
         spectrum s;
-        for(int i = 0; i < RESPONSE_SAMPLES; i++){
-            s[i] = studio_led_spd[i];
+        float spacing = (end - start) / (count - 1);
+        for (int i = 0; i < RESPONSE_SAMPLES; i++) {
+            float position = (s.get_wavelength(i) - start) / spacing;
+            if (position <= 0.0f) {
+                s[i] = float(samples[0]);
+            } else if (position >= count - 1) {
+                s[i] = float(samples[count - 1]);
+            } else {
+                int index = int(position);
+                float t = position - index;
+                s[i] = float(samples[index] * (1.0f - t) + samples[index + 1] * t);
+            }
         }
         return s;
     }
-    const std::vector<float>& get_data() const {
-        return data_;
+    sample_view get_data() const {
+        return sample_view(data_);
+    }
+    double average() const {
+        return sum() / RESPONSE_SAMPLES;
     }
 
 private:
-    std::vector<float> data_;
-    static inline std::vector<std::vector<std::vector<vec3>>> lookup_table;
+    alignas(32) float data_[PADDED_SAMPLES];
+
+    // Skips zeroing for results whose every lane is written right away
+    struct uninitialized_tag {};
+    explicit spectrum(uninitialized_tag) {}
+    // RGB to coefficient table, four floats per grid point so the two
+    // points along blue fill one AVX register
+    static inline std::vector<float> coefficient_table;
+    // Table in use, either coefficient_table or one owned elsewhere
+    static inline const float* coefficients = nullptr;
     static inline float step;
+    static inline int table_size = 0;
+    static inline int g_stride = 0;
+    static inline int r_stride = 0;
+
+    static void use_coefficients(const float* table, int size, float table_step) {
+        coefficients = table;
+        step = table_step;
+        table_size = size;
+        g_stride = size * 4;
+        r_stride = size * size * 4;
+    }
+
+    // Trilinear interpolation of the coefficients at an RGB colour, clamped
+    // to the unit cube
+    static void lookup_coefficients(float r, float g, float b, float* coeffs) {
+        const int last = table_size - 1;
+        float rs = std::min(std::max(r, 0.0f), 1.0f) * last;
+        float gs = std::min(std::max(g, 0.0f), 1.0f) * last;
+        float bs = std::min(std::max(b, 0.0f), 1.0f) * last;
+        int ri = std::min(int(rs), last - 1);
+        int gi = std::min(int(gs), last - 1);
+        int bi = std::min(int(bs), last - 1);
+        float fr = rs - ri;
+        float fg = gs - gi;
+        float fb = bs - bi;
+        const float* c000 = coefficients + ri * r_stride + gi * g_stride + bi * 4;
+#if defined(__AVX2__)
+        // Each load holds a point and its neighbour along blue
+        __m256 c00 = _mm256_loadu_ps(c000);
+        __m256 c01 = _mm256_loadu_ps(c000 + g_stride);
+        __m256 c10 = _mm256_loadu_ps(c000 + r_stride);
+        __m256 c11 = _mm256_loadu_ps(c000 + r_stride + g_stride);
+        __m256 vr = _mm256_set1_ps(fr);
+        __m256 c0 = _mm256_fmadd_ps(_mm256_sub_ps(c10, c00), vr, c00);
+        __m256 c1 = _mm256_fmadd_ps(_mm256_sub_ps(c11, c01), vr, c01);
+        __m256 c = _mm256_fmadd_ps(_mm256_sub_ps(c1, c0), _mm256_set1_ps(fg), c0);
+        __m128 lo = _mm256_castps256_ps128(c);
+        __m128 hi = _mm256_extractf128_ps(c, 1);
+        _mm_storeu_ps(coeffs, _mm_add_ps(lo, _mm_mul_ps(_mm_sub_ps(hi, lo), _mm_set1_ps(fb))));
+#elif defined(__SSE2__) || defined(_M_X64)
+        __m128 vr = _mm_set1_ps(fr);
+        __m128 vg = _mm_set1_ps(fg);
+        __m128 corners[2];
+        for (int k = 0; k < 2; ++k) {
+            const float* p = c000 + k * 4;
+            __m128 c00 = _mm_loadu_ps(p);
+            __m128 c01 = _mm_loadu_ps(p + g_stride);
+            __m128 c10 = _mm_loadu_ps(p + r_stride);
+            __m128 c11 = _mm_loadu_ps(p + r_stride + g_stride);
+            __m128 c0 = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c10, c00), vr));
+            __m128 c1 = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(c11, c01), vr));
+            corners[k] = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), vg));
+        }
+        _mm_storeu_ps(coeffs, _mm_add_ps(corners[0], _mm_mul_ps(_mm_sub_ps(corners[1], corners[0]), _mm_set1_ps(fb))));
+#else
+        for (int j = 0; j < 4; ++j) {
+            float v[2];
+            for (int k = 0; k < 2; ++k) {
+                const float* p = c000 + k * 4 + j;
+                float c0 = p[0] + (p[r_stride] - p[0]) * fr;
+                float c1 = p[g_stride] + (p[r_stride + g_stride] - p[g_stride]) * fr;
+                v[k] = c0 + (c1 - c0) * fg;
+            }
+            coeffs[j] = v[0] + (v[1] - v[0]) * fb;
+        }
+#endif
+    }
+
+    // Normalised position of each sample in the polynomial's domain
+    struct sample_positions {
+        alignas(32) float x[PADDED_SAMPLES];
+        sample_positions() : x() {
+            for (int i = 0; i < RESPONSE_SAMPLES; i++) {
+                float wavelength = START_WAVELENGTH + i * (END_WAVELENGTH - START_WAVELENGTH) / RESPONSE_SAMPLES;
+                x[i] = (wavelength - START_WAVELENGTH) / (END_WAVELENGTH - START_WAVELENGTH);
+            }
+        }
+    };
+    static inline const sample_positions positions;
+    // Illuminants are tabulated from 400 to 700nm in 10nm steps and resampled to the build's layout
+    static constexpr int ILLUMINANT_SAMPLES = 31;
+    static constexpr float ILLUMINANT_START = 400.0f;
+    static constexpr float ILLUMINANT_END = 700.0f;
     // D50 from 400 to 700nm in 10nm step
-    static inline double d50_spd[31] = {
+    static inline double d50_spd[ILLUMINANT_SAMPLES] = {
         18.0306416435159065, 20.6652060223712901, 21.9527407119419564, 21.1422996064334434, 27.3614468598853620, 
         31.9039467673700941, 33.1344364664343658, 33.4108486992791427, 34.7786120485748356, 33.6282778746323672, 
         35.0035740880590254, 35.3288768031519211, 35.5174543775374971, 37.3348492673887336, 36.8433847337951619, 
@@ -669,7 +809,7 @@ private:
         34.9829135626512695, 35.9053603129809957, 37.6654176739129838, 36.2502631017350510, 31.9528372496181987, 
         33.4969281272612278
     };
-    static inline double d65_spd[31] = {
+    static inline double d65_spd[ILLUMINANT_SAMPLES] = {
         28.8166638832520299, 31.8569814237367765, 32.5345420827917948, 30.1842513703383979, 36.5157768073820819, 
         40.7441759660340708, 41.0241424424860455, 39.9965540444639700, 40.3663605096281231, 37.8898411308639851, 
         38.0789229675722112, 37.5384901672569811, 36.4896605315936569, 37.4991416450690807, 36.3555969825463876, 
@@ -678,7 +818,7 @@ private:
         27.8666930568731601, 27.9320882114473967, 28.6505295475365607, 27.2598900943542723, 24.2781426550377049, 
         24.9355067274829914
     };
-    static inline double d65_cb_spd[31] = {
+    static inline double d65_cb_spd[ILLUMINANT_SAMPLES] = {
         27.4641780627958099, 32.6944719012318643, 35.4812882740959665, 37.4376353241936073, 38.2055015413569308, 
         38.9342408175183081, 39.0643378963497980, 38.8344671179633281, 38.2866899439359827, 37.9316129543432652, 
         37.4200282007427276, 36.3440373231890277, 34.9931796850965995, 33.4750543742208322, 33.8291531902884941, 
@@ -687,7 +827,7 @@ private:
         24.8690837008412835, 25.0881945704522131, 26.7833692893618220, 29.3598783543404203, 32.3609147291902133, 
         34.1734702711056855
     };
-    static inline double d50_cb_spd[31] = {
+    static inline double d50_cb_spd[ILLUMINANT_SAMPLES] = {
         19.8664266423976557, 23.6741337318269345, 26.1948328629854927, 28.3615677800741857, 29.7344750036840431, 
         31.2421552125673578, 32.2299967639673284, 32.9408872357394245, 33.4133331951046344, 33.9331718525879751, 
         34.3774783974455289, 34.3345287647759605, 34.1449579723034091, 33.7480441255639931, 34.5818594080800068, 
@@ -696,7 +836,7 @@ private:
         31.4435741795694454, 31.8908427680593967, 33.4873842859142243, 35.9814250243813163, 38.9271774167869395, 
         40.7710495779458100
     };
-    static inline double studio_led_spd[31] = {
+    static inline double studio_led_spd[ILLUMINANT_SAMPLES] = {
         0.0076918600433055, 0.1269077935276378, 0.5329653496946619, 2.3022668977667857, 9.3757140290895560, 
         37.9950088041393386, 63.2875346245249659, 45.2798004513542409, 31.0892347451363449, 25.8727005533851084, 
         27.3306791993759290, 30.7703147492545632, 33.7864399599110428, 36.2222798769514114, 38.2913744342267748, 
@@ -705,13 +845,46 @@ private:
         42.0532783872339735, 37.3181882978236601, 32.1100725073108038, 27.0223572283176772, 22.3252684022835552, 
         17.7050507935610675
     };
-    double integrate(const double* y, int length) const {
-        double sum = 0;
-        int i;
-        for(i = 0; i < length-1; i++){
-            sum += y[i];
+    // Element-wise ops over whole lanes. The op is a template argument so it
+    // is inlined, and binary operators write straight into the result instead
+    // of copying an operand first, which would make the lane loads wait on
+    // the copy's narrower stores.
+    template <spectrum_simd::lane (*op)(spectrum_simd::lane, spectrum_simd::lane)>
+    spectrum& apply(const spectrum& v) {
+        RAYDAR_SPECTRUM_COUNT(sampled_ops);
+        for (int i = 0; i < PADDED_SAMPLES; i += spectrum_simd::WIDTH)
+            spectrum_simd::store(data_ + i, op(spectrum_simd::load(data_ + i), spectrum_simd::load(v.data_ + i)));
+        return *this;
+    }
+    template <spectrum_simd::lane (*op)(spectrum_simd::lane, spectrum_simd::lane)>
+    static spectrum combined(const spectrum& a, const spectrum& b) {
+        RAYDAR_SPECTRUM_COUNT(sampled_ops);
+        spectrum result(uninitialized_tag{});
+        for (int i = 0; i < PADDED_SAMPLES; i += spectrum_simd::WIDTH)
+            spectrum_simd::store(result.data_ + i, op(spectrum_simd::load(a.data_ + i), spectrum_simd::load(b.data_ + i)));
+        return result;
+    }
+    static spectrum scaled(const spectrum& a, double t) {
+        RAYDAR_SPECTRUM_COUNT(sampled_ops);
+        spectrum result(uninitialized_tag{});
+        spectrum_simd::lane factor = spectrum_simd::set1(float(t));
+        for (int i = 0; i < PADDED_SAMPLES; i += spectrum_simd::WIDTH)
+            spectrum_simd::store(result.data_ + i, spectrum_simd::mul(spectrum_simd::load(a.data_ + i), factor));
+        return result;
+    }
+
+    // Evaluates spectrum_function at every sample, with the polynomials first
+    // and the sigmoids as one batch over whole lanes
+    void from_coefficients(float coeff_a, float coeff_b, float coeff_c) {
+        spectrum_simd::lane a = spectrum_simd::set1(coeff_a);
+        spectrum_simd::lane b = spectrum_simd::set1(coeff_b);
+        spectrum_simd::lane c = spectrum_simd::set1(coeff_c);
+        for (int i = 0; i < PADDED_SAMPLES; i += spectrum_simd::WIDTH) {
+            spectrum_simd::lane x = spectrum_simd::load(positions.x + i);
+            spectrum_simd::store(data_ + i, spectrum_simd::fmadd(spectrum_simd::fmadd(a, x, b), x, c));
         }
-        return sum;
+        fast_sigmoid(data_, data_, PADDED_SAMPLES);
+        std::fill(data_ + RESPONSE_SAMPLES, data_ + PADDED_SAMPLES, 0.0f);
     }
 
     // modesl a spectrum function from a polynomial
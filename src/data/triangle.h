@@ -70,6 +70,21 @@ public:
         return false;
     }
 
+    const point3& vertex(int index) const {
+        if (index == 1) return v1;
+        if (index == 2) return v2;
+        return v0;
+    }
+    const vec3& get_face_normal() const {
+        return face_normal;
+    }
+    rd::core::material* get_material() const {
+        return mat;
+    }
+    double area() const {
+        return 0.5 * cross(edge1, edge2).length();
+    }
+
     void print() const {
         std::cout << "Triangle:\n"
                   << "  v0: " << v0 << ", n0: " << n0 << "\n"
@@ -7,6 +7,7 @@
 #include <pxr/base/gf/vec3d.h>
 #include "../helpers/random.h"
 #include "../helpers/math.h"
+#include "../helpers/fast_math.h"
 
 class vec3 {
   public:
@@ -179,10 +180,23 @@ inline vec3 random_cosine_direction() {
 
     return vec3(x, y, z);
 }
+// Direction about +z with density (n + 1) / (2 pi) cos^n(theta), n = 1 is
+// random_cosine_direction
+inline vec3 random_cosine_power_direction(double n) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+
+    auto phi = 2*pi*r1;
+    auto z = std::pow(r2, 1.0 / (n + 1));
+    auto sin_theta = std::sqrt(std::max(0.0, 1 - z*z));
+
+    return vec3(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, z);
+}
 inline double linear_to_gamma2(double linear_component, float gamma = 2.2)
 {   
+    // Output is quantised to 8 bits, far coarser than the error of fast_pow
     if (linear_component > 0)
-        return std::pow(linear_component, (1/gamma));
+        return fast_pow(float(linear_component), 1.0f / gamma);
 
     return 0;
 }
@@ -0,0 +1,142 @@
+#ifndef DITHERING_H
+#define DITHERING_H
+
+#include "../data/vec3.h"
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iostream>
+
+// Blue noise tile built with the void-and-cluster method (Ulichney 1993).
+// Using it to offset the samples of each pixel makes the error of
+// neighbouring pixels anti-correlated, so at low sample counts the noise ends
+// up in high frequencies where it is far less visible and easier to filter.
+class dithering {
+  public:
+    dithering(int size = 64) : size(size), ranks(size * size) {
+        build();
+    }
+
+    // Blue noise value in [0, 1) for pixel (x, y). Different channels read
+    // the tile at a fixed offset, which keeps them decorrelated enough for
+    // the two pixel dimensions.
+    double value(int x, int y, int channel = 0) const {
+        x = (x + channel * 37) % size;
+        y = (y + channel * 23) % size;
+        return ranks[y * size + x];
+    }
+
+    // Toroidal shift (Cranley-Patterson rotation) of a sample in [0, 1)^2 by
+    // the tile value of pixel (i, j). When all pixels share one stratified
+    // pattern, this is the only difference between them. Successive frames
+    // rotate the tile by the golden ratio so progressive passes do not repeat
+    // the same positions.
+    vec3 sample_square_dithered(const vec3& u, int i, int j, int frame = 0) const {
+        const double golden_ratio = 0.61803398874989484820;
+        double x = u.x() + value(i, j, 0) + frame * golden_ratio;
+        double y = u.y() + value(i, j, 1) + frame * golden_ratio;
+        return vec3(x - std::floor(x), y - std::floor(y), 0);
+    }
+
+  private:
+    int size;
+    std::vector<double> ranks;
+
+    void build() {
+        const int n = size * size;
+        const double sigma = 1.5;
+
+        // Toroidal Gaussian, so the tile repeats without seams
+        std::vector<double> kernel(n);
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                int dx = std::min(x, size - x);
+                int dy = std::min(y, size - y);
+                kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+
+        std::vector<char> pattern(n, 0);
+        std::vector<double> energy(n, 0.0);
+        auto splat = [&](int index, double sign) {
+            int px = index % size, py = index / size;
+            for (int y = 0; y < size; ++y) {
+                int ky = (y - py + size) % size;
+                for (int x = 0; x < size; ++x) {
+                    int kx = (x - px + size) % size;
+                    energy[y * size + x] += sign * kernel[ky * size + kx];
+                }
+            }
+        };
+        // Tightest cluster among set pixels or largest void among unset ones
+        auto tightest_cluster = [&]() {
+            int best = -1;
+            for (int i = 0; i < n; ++i)
+                if (pattern[i] && (best < 0 || energy[i] > energy[best]))
+                    best = i;
+            return best;
+        };
+        auto largest_void = [&]() {
+            int best = -1;
+            for (int i = 0; i < n; ++i)
+                if (!pattern[i] && (best < 0 || energy[i] < energy[best]))
+                    best = i;
+            return best;
+        };
+
+        // Initial binary pattern from a fixed seed, so every run gets the same tile
+        std::mt19937 rng(1993);
+        int ones = n / 10;
+        std::vector<int> order(n);
+        for (int i = 0; i < n; ++i)
+            order[i] = i;
+        std::shuffle(order.begin(), order.end(), rng);
+        for (int i = 0; i < ones; ++i) {
+            pattern[order[i]] = 1;
+            splat(order[i], 1.0);
+        }
+
+        // Move pixels from clusters into voids until the pattern is evenly spread
+        while (true) {
+            int cluster = tightest_cluster();
+            pattern[cluster] = 0;
+            splat(cluster, -1.0);
+            int gap = largest_void();
+            if (gap == cluster) {
+                pattern[cluster] = 1;
+                splat(cluster, 1.0);
+                break;
+            }
+            pattern[gap] = 1;
+            splat(gap, 1.0);
+        }
+
+        // Ranks below the initial pattern: remove the tightest clusters one by one
+        std::vector<char> initial_pattern = pattern;
+        std::vector<double> initial_energy = energy;
+        std::vector<int> rank(n, 0);
+        for (int r = ones - 1; r >= 0; --r) {
+            int cluster = tightest_cluster();
+            pattern[cluster] = 0;
+            splat(cluster, -1.0);
+            rank[cluster] = r;
+        }
+
+        // Ranks above it: fill the largest voids. Past half full the largest void
+        // is also the tightest cluster of unset pixels, so one rule covers both halves.
+        pattern = initial_pattern;
+        energy = initial_energy;
+        for (int r = ones; r < n; ++r) {
+            int gap = largest_void();
+            pattern[gap] = 1;
+            splat(gap, 1.0);
+            rank[gap] = r;
+        }
+
+        for (int i = 0; i < n; ++i)
+            ranks[i] = (rank[i] + 0.5) / n;
+        std::cout << "Blue noise tile: " << size << "x" << size << std::endl;
+    }
+};
+
+#endif
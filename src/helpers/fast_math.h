@@ -0,0 +1,194 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Approximate transcendental functions for hot loops, in single precision.
+// Each scalar function has a batch version over arrays that runs 8 lanes at
+// a time when the compiler targets AVX2 (/arch:AVX2, -mavx2 or
+// -march=native) and falls back to the same scalar code otherwise, so both
+// paths round the same way up to the order of operations.
+//
+// Error bounds, relative unless noted, measured against double precision libm:
+//   fast_exp2             3e-7 for results in the normal float range
+//   fast_exp              3e-7 + 8e-8 |x|, from rounding x * log2(e)
+//   fast_log2             3e-7 absolute for x in the normal float range
+//   fast_log              3e-7 + 8e-8 |log(x)| absolute
+//   fast_pow              2e-6 for x >= 0 and |y * log2(x)| <= 16, 2.5e-6 in
+//                         the AVX2 path, growing linearly with
+//                         |y * log2(x)| beyond that
+//   fast_rsqrt            exact scalar, 3e-7 in the AVX2 path
+//   fast_sigmoid          2e-7 absolute
+// Inputs are not checked for NaN, infinities or denormals; results for them
+// are not meaningful, and a NaN reaching fast_exp2 is undefined behaviour in
+// its integer conversion. raydar_check_math measures these bounds and
+// times each function against libm.
+
+inline float fast_bits_to_float(uint32_t bits) {
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+inline uint32_t fast_float_to_bits(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// 2^x as 2^round(x) times a degree 6 Taylor polynomial of 2^f, |f| <= 0.5
+inline float fast_exp2(float x) {
+    x = std::min(std::max(x, -126.0f), 127.0f);
+    // Rounds to the nearest integer without a libm call on targets lacking SSE4.1
+    float shifted = x + 0.5f;
+    int32_t xi = int32_t(shifted);
+    xi -= shifted < float(xi) ? 1 : 0;
+    float f = x - float(xi);
+    float p = 1.5403530e-4f;
+    p = p * f + 1.3333558e-3f;
+    p = p * f + 9.6181291e-3f;
+    p = p * f + 5.5504109e-2f;
+    p = p * f + 2.4022651e-1f;
+    p = p * f + 6.9314718e-1f;
+    p = p * f + 1.0f;
+    return p * fast_bits_to_float(uint32_t(xi + 127) << 23);
+}
+
+// log2(x) for x > 0, from the exponent bits and an odd series in
+// t = (m - 1) / (m + 1) of the mantissa m, taken in [sqrt(1/2), sqrt(2))
+inline float fast_log2(float x) {
+    uint32_t bits = fast_float_to_bits(x);
+    int e = int((bits >> 23) & 0xff) - 127;
+    float m = fast_bits_to_float((bits & 0x7fffff) | 0x3f800000);
+    if (m > 1.41421356f) {
+        m *= 0.5f;
+        e += 1;
+    }
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+    float p = 0.41219858f;
+    p = p * t2 + 0.57707802f;
+    p = p * t2 + 0.96179669f;
+    p = p * t2 + 2.88539008f;
+    return float(e) + t * p;
+}
+
+inline float fast_exp(float x) {
+    return fast_exp2(x * 1.44269504f);
+}
+inline float fast_log(float x) {
+    return fast_log2(x) * 0.69314718f;
+}
+
+// x^y for x >= 0
+inline float fast_pow(float x, float y) {
+    if (x <= 0.0f)
+        return 0.0f;
+    return fast_exp2(y * fast_log2(x));
+}
+
+inline float fast_rsqrt(float x) {
+    return 1.0f / std::sqrt(x);
+}
+
+// Sigmoid of the RGB to spectrum polynomials, 0.5 + 0.5 y / sqrt(1 + y^2)
+inline float fast_sigmoid(float y) {
+    y = std::min(std::max(y, -1e8f), 1e8f);
+    return 0.5f * y * fast_rsqrt(1.0f + y * y) + 0.5f;
+}
+
+#ifdef __AVX2__
+inline __m256 fast_exp2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-126.0f)), _mm256_set1_ps(127.0f));
+    __m256 xi = _mm256_floor_ps(_mm256_add_ps(x, _mm256_set1_ps(0.5f)));
+    __m256 f = _mm256_sub_ps(x, xi);
+    __m256 p = _mm256_set1_ps(1.5403530e-4f);
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.3333558e-3f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(9.6181291e-3f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(5.5504109e-2f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(2.4022651e-1f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(6.9314718e-1f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.0f));
+    __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(xi), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+}
+
+inline __m256 fast_log2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i e = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)), _mm256_set1_epi32(127));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x7fffff)), _mm256_set1_epi32(0x3f800000)));
+    __m256 above = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), above);
+    __m256 ef = _mm256_add_ps(_mm256_cvtepi32_ps(e), _mm256_and_ps(above, _mm256_set1_ps(1.0f)));
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_set1_ps(0.41219858f);
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(0.57707802f));
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(0.96179669f));
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(2.88539008f));
+    return _mm256_fmadd_ps(t, p, ef);
+}
+
+inline __m256 fast_pow(__m256 x, __m256 y) {
+    __m256 positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+    __m256 result = fast_exp2(_mm256_mul_ps(y, fast_log2(x)));
+    return _mm256_and_ps(result, positive);
+}
+
+// Hardware estimate refined with one Newton-Raphson step
+inline __m256 fast_rsqrt(__m256 x) {
+    __m256 r = _mm256_rsqrt_ps(x);
+    __m256 half_x = _mm256_mul_ps(x, _mm256_set1_ps(0.5f));
+    __m256 correction = _mm256_fnmadd_ps(_mm256_mul_ps(half_x, r), r, _mm256_set1_ps(1.5f));
+    return _mm256_mul_ps(r, correction);
+}
+
+inline __m256 fast_sigmoid(__m256 y) {
+    y = _mm256_min_ps(_mm256_max_ps(y, _mm256_set1_ps(-1e8f)), _mm256_set1_ps(1e8f));
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 r = fast_rsqrt(_mm256_fmadd_ps(y, y, _mm256_set1_ps(1.0f)));
+    return _mm256_fmadd_ps(_mm256_mul_ps(half, y), r, half);
+}
+#endif
+
+// Batch versions, out may alias the input
+#ifdef __AVX2__
+#define FAST_MATH_BATCH(lanes_expr, scalar_expr)                  \
+    int i = 0;                                                   \
+    for (; i + 8 <= n; i += 8) {                                 \
+        __m256 v = _mm256_loadu_ps(x + i);                       \
+        _mm256_storeu_ps(out + i, lanes_expr);                   \
+    }                                                            \
+    for (; i < n; ++i)                                           \
+        out[i] = scalar_expr;
+#else
+#define FAST_MATH_BATCH(lanes_expr, scalar_expr)                  \
+    for (int i = 0; i < n; ++i)                                  \
+        out[i] = scalar_expr;
+#endif
+
+inline void fast_exp2(const float* x, float* out, int n) {
+    FAST_MATH_BATCH(fast_exp2(v), fast_exp2(x[i]))
+}
+inline void fast_log2(const float* x, float* out, int n) {
+    FAST_MATH_BATCH(fast_log2(v), fast_log2(x[i]))
+}
+inline void fast_pow(const float* x, float y, float* out, int n) {
+    FAST_MATH_BATCH(fast_pow(v, _mm256_set1_ps(y)), fast_pow(x[i], y))
+}
+inline void fast_rsqrt(const float* x, float* out, int n) {
+    FAST_MATH_BATCH(fast_rsqrt(v), fast_rsqrt(x[i]))
+}
+inline void fast_sigmoid(const float* x, float* out, int n) {
+    FAST_MATH_BATCH(fast_sigmoid(v), fast_sigmoid(x[i]))
+}
+
+#undef FAST_MATH_BATCH
+
+#endif
@@ -0,0 +1,168 @@
+// Measures the fast_math functions against libm: the largest error of each
+// over the range its documented bound covers, and the time per call of the
+// scalar and batch versions. Exits with 1 when an error exceeds its bound.
+//
+//   raydar_check_math [--count n]
+
+#include "helpers/fast_math.h"
+#include "helpers/cxxopts.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+// Measures each fast_math function against double precision libm over the
+// ranges its documented bound covers, and times the scalar and batch
+// versions against the float libm call they replace. Returns false when an
+// error exceeds the bound in fast_math.h.
+bool check_math(int count) {
+    std::mt19937 rng(1);
+    auto uniform = [&](float lo, float hi) {
+        std::vector<float> v(count);
+        std::uniform_real_distribution<float> d(lo, hi);
+        for (float& x : v)
+            x = d(rng);
+        return v;
+    };
+    // Positive values with log2 uniform in [lo, hi]
+    auto logarithmic = [&](float lo, float hi) {
+        std::vector<float> v = uniform(lo, hi);
+        for (float& x : v)
+            x = std::exp2(x);
+        return v;
+    };
+
+    struct function {
+        const char* name;
+        std::vector<float> x;
+        float y;            // exponent of fast_pow, unused otherwise
+        bool relative;
+        double bound;
+        double growth;      // added to the bound per unit of |x|, or of |result| for absolute errors
+        double batch_bound; // bound of the batch version where it rounds differently, else 0
+        float (*fast)(float, float);
+        void (*batch)(const float*, float, float*, int);
+        float (*libm)(float, float);
+        double (*reference)(double, double);
+    };
+    function functions[] = {
+        {"fast_exp2", uniform(-126.0f, 127.0f), 0.0f, true, 3e-7, 0.0, 0.0,
+         [](float x, float) { return fast_exp2(x); },
+         [](const float* x, float, float* out, int n) { fast_exp2(x, out, n); },
+         [](float x, float) { return std::exp2(x); },
+         [](double x, double) { return std::exp2(x); }},
+        {"fast_exp", uniform(-87.0f, 88.0f), 0.0f, true, 3e-7, 8e-8, 0.0,
+         [](float x, float) { return fast_exp(x); },
+         nullptr,
+         [](float x, float) { return std::exp(x); },
+         [](double x, double) { return std::exp(x); }},
+        {"fast_log2", logarithmic(-126.0f, 127.0f), 0.0f, false, 3e-7, 0.0, 0.0,
+         [](float x, float) { return fast_log2(x); },
+         [](const float* x, float, float* out, int n) { fast_log2(x, out, n); },
+         [](float x, float) { return std::log2(x); },
+         [](double x, double) { return std::log2(x); }},
+        {"fast_log", logarithmic(-126.0f, 127.0f), 0.0f, false, 3e-7, 8e-8, 0.0,
+         [](float x, float) { return fast_log(x); },
+         nullptr,
+         [](float x, float) { return std::log(x); },
+         [](double x, double) { return std::log(x); }},
+        // Exponent 16 over bases in [1/2, 2] reaches |y * log2(x)| = 16
+        {"fast_pow", logarithmic(-1.0f, 1.0f), 16.0f, true, 2e-6, 0.0, 2.5e-6,
+         [](float x, float y) { return fast_pow(x, y); },
+         [](const float* x, float y, float* out, int n) { fast_pow(x, y, out, n); },
+         [](float x, float y) { return std::pow(x, y); },
+         [](double x, double y) { return std::pow(x, y); }},
+        {"fast_rsqrt", logarithmic(-126.0f, 127.0f), 0.0f, true, 3e-7, 0.0, 0.0,
+         [](float x, float) { return fast_rsqrt(x); },
+         [](const float* x, float, float* out, int n) { fast_rsqrt(x, out, n); },
+         [](float x, float) { return 1.0f / std::sqrt(x); },
+         [](double x, double) { return 1.0 / std::sqrt(x); }},
+        {"fast_sigmoid", uniform(-1e3f, 1e3f), 0.0f, false, 2e-7, 0.0, 0.0,
+         [](float x, float) { return fast_sigmoid(x); },
+         [](const float* x, float, float* out, int n) { fast_sigmoid(x, out, n); },
+         [](float x, float) { return 0.5f * x / std::sqrt(1.0f + x * x) + 0.5f; },
+         [](double x, double) { return 0.5 * x / std::sqrt(1.0 + x * x) + 0.5; }},
+    };
+
+    // Keeps the timed loops from being optimised away
+    volatile float sink = 0.0f;
+    auto time = [&](auto&& body) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / count;
+    };
+
+    bool passed = true;
+    std::vector<float> out(count);
+    std::cout << "Checking " << count << " arguments per function against libm" << std::endl;
+    for (const function& f : functions) {
+        // Errors as a fraction of the bound at each argument
+        double worst = 0.0, batch_worst = 0.0;
+        if (f.batch)
+            f.batch(f.x.data(), f.y, out.data(), count);
+        for (int i = 0; i < count; ++i) {
+            double expected = f.reference(f.x[i], f.y);
+            double scale = f.relative ? std::abs(expected) : 1.0;
+            double growth = f.growth * std::abs(f.relative ? double(f.x[i]) : expected);
+            double bound = f.bound + growth;
+            double batch_bound = (f.batch_bound > 0.0 ? f.batch_bound : f.bound) + growth;
+            worst = std::max(worst, std::abs(f.fast(f.x[i], f.y) - expected) / scale / bound);
+            if (f.batch)
+                batch_worst = std::max(batch_worst, std::abs(out[i] - expected) / scale / batch_bound);
+        }
+
+        double libm_ns = time([&] {
+            float sum = 0.0f;
+            for (int i = 0; i < count; ++i)
+                sum += f.libm(f.x[i], f.y);
+            sink = sum;
+        });
+        double fast_ns = time([&] {
+            float sum = 0.0f;
+            for (int i = 0; i < count; ++i)
+                sum += f.fast(f.x[i], f.y);
+            sink = sum;
+        });
+        double batch_ns = f.batch ? time([&] { f.batch(f.x.data(), f.y, out.data(), count); sink = out[count - 1]; }) : 0.0;
+
+        bool ok = worst <= 1.0 && batch_worst <= 1.0;
+        passed = passed && ok;
+        std::cout << "  " << f.name << (f.relative ? " relative" : " absolute") << " error up to " << worst;
+        if (f.batch)
+            std::cout << ", batch " << batch_worst;
+        std::cout << " of the bound " << f.bound;
+        if (f.growth > 0.0)
+            std::cout << " + " << f.growth << (f.relative ? " |x|" : " |result|");
+        if (f.batch_bound > 0.0)
+            std::cout << ", " << f.batch_bound << " batch";
+        std::cout << (ok ? "" : ", FAILED") << std::endl;
+        std::cout << "    libm " << libm_ns << " ns, fast " << fast_ns << " ns";
+        if (f.batch)
+            std::cout << ", batch " << batch_ns << " ns";
+        std::cout << std::endl;
+    }
+    return passed;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options("raydar_check_math", "Check the fast_math functions against libm");
+    options.add_options()
+        ("h,help", "Print help")
+        ("count", "Arguments per function", cxxopts::value<int>()->default_value("4194304"));
+
+    auto result = options.parse(argc, argv);
+    if (result.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+    int count = result["count"].as<int>();
+    if (count <= 0) {
+        std::cerr << "Error: Count must be positive." << std::endl;
+        return 1;
+    }
+    return check_math(count) ? 0 : 1;
+}
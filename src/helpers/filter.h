@@ -0,0 +1,112 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "../data/vec3.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+
+// Pixel reconstruction filter used through filter importance sampling (Ernst
+// et al. 2006): camera samples are placed around the pixel center with a
+// density proportional to |f|, and each sample is weighted by the sign of f.
+// Every sample still belongs to exactly one pixel, so buckets never write to
+// each other's pixels and no splatting or locking is needed.
+class pixel_filter {
+  public:
+    enum filter_type {
+        BOX,
+        GAUSSIAN,
+        MITCHELL,
+        BLACKMAN_HARRIS
+    };
+
+    pixel_filter(filter_type type = BOX) : type(type) {
+        switch (type) {
+            case BOX: radius = 0.5; break;
+            case GAUSSIAN: radius = 1.5; break;
+            case MITCHELL: radius = 2.0; break;
+            case BLACKMAN_HARRIS: radius = 2.0; break;
+        }
+        build_table();
+    }
+
+    static filter_type type_from_string(const std::string& name) {
+        if (name == "gaussian") return GAUSSIAN;
+        if (name == "mitchell") return MITCHELL;
+        if (name == "blackman_harris") return BLACKMAN_HARRIS;
+        return BOX;
+    }
+
+    filter_type get_type() const { return type; }
+    double get_radius() const { return radius; }
+
+    // Maps a uniform sample in [0, 1)^2 to an offset from the pixel center.
+    // The filters are separable, so each axis is sampled on its own and the
+    // stratification of the input carries over.
+    vec3 sample(double u1, double u2, double& weight) const {
+        double wx, wy;
+        double x = sample_1d(u1, wx);
+        double y = sample_1d(u2, wy);
+        weight = wx * wy;
+        return vec3(x, y, 0);
+    }
+
+    double evaluate(double x) const {
+        x = std::fabs(x);
+        if (x > radius)
+            return 0.0;
+        switch (type) {
+            case GAUSSIAN: {
+                const double sigma = 0.5;
+                double edge = std::exp(-radius * radius / (2 * sigma * sigma));
+                return std::max(0.0, std::exp(-x * x / (2 * sigma * sigma)) - edge);
+            }
+            case MITCHELL: {
+                // B = C = 1/3, as recommended by Mitchell and Netravali
+                const double B = 1.0 / 3.0, C = 1.0 / 3.0;
+                if (x < 1)
+                    return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6;
+                return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6;
+            }
+            case BLACKMAN_HARRIS: {
+                double t = 2 * pi * (x / (2 * radius) + 0.5);
+                return 0.35875 - 0.48829 * std::cos(t) + 0.14128 * std::cos(2 * t) - 0.01168 * std::cos(3 * t);
+            }
+            default:
+                return 1.0;
+        }
+    }
+
+  private:
+    static constexpr int TABLE_SIZE = 256;
+
+    filter_type type;
+    double radius = 0.5;
+    // Piecewise constant |f| over [-radius, radius], its sign and cumulative distribution
+    std::vector<double> cdf;
+    std::vector<double> sign;
+
+    void build_table() {
+        cdf.assign(TABLE_SIZE + 1, 0.0);
+        sign.assign(TABLE_SIZE, 1.0);
+        for (int i = 0; i < TABLE_SIZE; ++i) {
+            double x = -radius + (i + 0.5) * 2 * radius / TABLE_SIZE;
+            double f = evaluate(x);
+            sign[i] = f < 0 ? -1.0 : 1.0;
+            cdf[i + 1] = cdf[i] + std::fabs(f);
+        }
+        for (int i = 1; i <= TABLE_SIZE; ++i)
+            cdf[i] /= cdf[TABLE_SIZE];
+    }
+
+    double sample_1d(double u, double& weight) const {
+        int bin = int(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+        bin = std::clamp(bin, 0, TABLE_SIZE - 1);
+        double bin_width = cdf[bin + 1] - cdf[bin];
+        double t = bin_width > 0 ? (u - cdf[bin]) / bin_width : 0.5;
+        weight = sign[bin];
+        return -radius + (bin + t) * 2 * radius / TABLE_SIZE;
+    }
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "../data/vec3.h"
+#include <cstdint>
+#include <cmath>
+
+// Correlated multi-jittered sampling from Kensler (2013), "Correlated
+// Multi-Jittered Sampling". Sample s of an N sample pattern is computed on its
+// own, and any N is stratified in 2D as well as along each axis. Different
+// pattern seeds give decorrelated patterns, e.g. one per pixel.
+
+// Pseudo-random permutation of i in [0, l)
+inline uint32_t cmj_permute(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// Hashed float in [0, 1)
+inline double cmj_randfloat(uint32_t i, uint32_t p) {
+    i ^= p;
+    i ^= i >> 17;
+    i ^= i >> 10;
+    i *= 0xb36534e5;
+    i ^= i >> 12;
+    i ^= i >> 21;
+    i *= 0x93fc4795;
+    i ^= 0xdf6e307f;
+    i ^= i >> 17;
+    i *= 1 | p >> 18;
+    return i * (1.0 / 4294967808.0);
+}
+
+// Sample s of the N sample pattern p, in [0, 1)^2
+inline vec3 cmj_sample(int s, int N, uint32_t p) {
+    int m = std::max(1, int(std::sqrt(double(N))));
+    int n = (N + m - 1) / m;
+    s = cmj_permute(s, N, p * 0x51633e2d);
+    int sx = cmj_permute(s % m, m, p * 0x68bc21eb);
+    int sy = cmj_permute(s / m, n, p * 0x02e5be93);
+    double jx = cmj_randfloat(s, p * 0x967a889b);
+    double jy = cmj_randfloat(s, p * 0x368cc8b7);
+    return vec3((sx + (sy + jx) / n) / m, (s + jy) / N, 0);
+}
+
+#endif
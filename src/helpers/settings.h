@@ -3,6 +3,7 @@
 
 #include "cxxopts.hpp"
 #include "strings.h"
+#include "../data/spectrum.h"
 #include <iostream>
 
 class settings {
@@ -19,11 +20,34 @@ class settings {
     float exposure = 100.0;
     float shutter = 125.0;
     int samples = 4;
+    int fast_samples = 16;
+    int fast_cache_memory = 32;
     int max_depth = 3;
     bool show_ui = false;
+    bool restir = false;
+    int split = 1;
+    bool guiding = false;
+    int guiding_memory = 64;
+    bool denoise = false;
+    std::string denoise_domain = "xyz";
+    bool blue_noise = false;
+    std::string filter = "box";
+    float time_limit = 0.0f;
+    float target_noise = 0.0f;
+    int photons = 0;
+    int photon_passes = 4;
+    float photon_radius = 0.0f;
     std::string usd_file;
     std::string image_file = "output.png";
     std::string spd_file = "";
+    // Solid angle sampling costs about 12x more per sample but has lower
+    // variance x time at every placement raydar_light_benchmark tries
+    std::string light_sampling = "solid_angle";
+    std::string lut_path = "";
+    std::string uplift = "lut";
+    std::string uplift_model = "spectral_net.bin";
+    std::string film = "spectral";
+    int film_components = 8;
 
     int error = 0;
 
@@ -42,6 +66,27 @@ class settings {
             ("gm,gamma", "Gamma", cxxopts::value<float>()->default_value("2.2"))
             ("ex,exposure", "Exposure", cxxopts::value<float>()->default_value("100.0"))
             ("sh,shutter", "Shutter", cxxopts::value<float>()->default_value("125.0"))
+            ("light-sampling", "Default area light sampling (area, solid_angle)", cxxopts::value<std::string>()->default_value("solid_angle"))
+            ("restir", "Resampled direct lighting", cxxopts::value<bool>()->default_value("false"))
+            ("split", "Secondary paths traced from the first diffuse hit of each camera ray", cxxopts::value<int>()->default_value("1"))
+            ("guiding", "Path guiding for indirect light", cxxopts::value<bool>()->default_value("false"))
+            ("guiding-memory", "Path guiding memory budget in MB", cxxopts::value<int>()->default_value("64"))
+            ("denoise", "Denoise with albedo, normal and depth features", cxxopts::value<bool>()->default_value("false"))
+            ("fast-samples", "Samples per pixel in the Fast render mode", cxxopts::value<int>()->default_value("16"))
+            ("fast-cache-memory", "Radiance cache for the Fast render mode in MB, 0 shades it without bounce light", cxxopts::value<int>()->default_value("32"))
+            ("filter", "Pixel reconstruction filter (box, gaussian, mitchell, blackman_harris)", cxxopts::value<std::string>()->default_value("box"))
+            ("blue-noise", "Blue noise pixel sampling", cxxopts::value<bool>()->default_value("false"))
+            ("time-limit", "Render progressive passes of --samples until this many seconds have passed", cxxopts::value<float>()->default_value("0.0"))
+            ("target-noise", "Render progressive passes of --samples until the relative noise drops below this", cxxopts::value<float>()->default_value("0.0"))
+            ("photons", "Caustic photons traced per pass, 0 disables photon mapping", cxxopts::value<int>()->default_value("0"))
+            ("photon-passes", "Photon passes with shrinking gather radius", cxxopts::value<int>()->default_value("4"))
+            ("photon-radius", "Initial photon gather radius, 0 picks one from the scene size", cxxopts::value<float>()->default_value("0.0"))
+            ("denoise-domain", "Denoiser weights from xyz or per spectral band (xyz, spectral)", cxxopts::value<std::string>()->default_value("xyz"))
+            ("lut-path", "Directories searched for lookup_table.bin before RAYDAR_LUT_PATH and the working directory", cxxopts::value<std::string>()->default_value(""))
+            ("uplift", "RGB to spectrum uplifting of material colours and textures (lut, net)", cxxopts::value<std::string>()->default_value("lut"))
+            ("uplift-model", "Weights exported by assets/train_spectral.py for --uplift net", cxxopts::value<std::string>()->default_value("spectral_net.bin"))
+            ("film", "Pixel storage: every spectral sample, XYZ only without the SPD output, or spectral basis coefficients (spectral, xyz, pca)", cxxopts::value<std::string>()->default_value("spectral"))
+            ("film-components", "Spectral basis components per pixel of the pca film, at least 3", cxxopts::value<int>()->default_value("8"))
             ("ui", "Show UI", cxxopts::value<bool>()->default_value("false"));
 
         auto result = options.parse(argc, argv);    
@@ -122,6 +167,130 @@ class settings {
         // EXPOSURE
         if (result.count("shutter")) shutter = result["shutter"].as<float>();
         std::cout << "Shutter: " << shutter << std::endl;
+
+        // RESTIR
+        if (result.count("restir")) restir = result["restir"].as<bool>();
+        std::cout << "ReSTIR: " << restir << std::endl;
+
+        // PATH SPLITTING
+        if (result.count("split")) split = result["split"].as<int>();
+        if (split < 1) {
+            std::cerr << "Error: Split must be at least 1." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Split: " << split << std::endl;
+
+        // PATH GUIDING
+        if (result.count("guiding")) guiding = result["guiding"].as<bool>();
+        if (result.count("guiding-memory")) guiding_memory = result["guiding-memory"].as<int>();
+        std::cout << "Path guiding: " << guiding << " (" << guiding_memory << " MB)" << std::endl;
+
+        // FAST MODE SAMPLES
+        if (result.count("fast-samples")) fast_samples = result["fast-samples"].as<int>();
+        if (fast_samples < 1) {
+            std::cerr << "Error: Fast mode needs at least one sample." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Fast samples: " << fast_samples << std::endl;
+
+        // FAST MODE RADIANCE CACHE
+        if (result.count("fast-cache-memory")) fast_cache_memory = result["fast-cache-memory"].as<int>();
+        if (fast_cache_memory < 0) {
+            std::cerr << "Error: Radiance cache memory must not be negative." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Fast radiance cache: " << fast_cache_memory << " MB" << std::endl;
+
+        // PIXEL FILTER
+        if (result.count("filter")) filter = result["filter"].as<std::string>();
+        if (filter != "box" && filter != "gaussian" && filter != "mitchell" && filter != "blackman_harris") {
+            std::cerr << "Error: Filter must be box, gaussian, mitchell or blackman_harris." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Filter: " << filter << std::endl;
+
+        // BLUE NOISE
+        if (result.count("blue-noise")) blue_noise = result["blue-noise"].as<bool>();
+        std::cout << "Blue noise: " << blue_noise << std::endl;
+
+        // RENDER BUDGET
+        if (result.count("time-limit")) time_limit = result["time-limit"].as<float>();
+        if (result.count("target-noise")) target_noise = result["target-noise"].as<float>();
+        if (time_limit < 0 || target_noise < 0) {
+            std::cerr << "Error: Time limit and target noise must not be negative." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Time limit: " << time_limit << " seconds, target noise: " << target_noise << std::endl;
+
+        // PHOTON MAPPING
+        if (result.count("photons")) photons = result["photons"].as<int>();
+        if (result.count("photon-passes")) photon_passes = result["photon-passes"].as<int>();
+        if (result.count("photon-radius")) photon_radius = result["photon-radius"].as<float>();
+        if (photons < 0 || photon_passes < 1 || photon_radius < 0) {
+            std::cerr << "Error: Photon count and radius must not be negative, with at least one pass." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Photons: " << photons << " x " << photon_passes << " passes" << std::endl;
+
+        // DENOISE
+        if (result.count("denoise")) denoise = result["denoise"].as<bool>();
+        if (result.count("denoise-domain")) denoise_domain = result["denoise-domain"].as<std::string>();
+        if (denoise_domain != "xyz" && denoise_domain != "spectral") {
+            std::cerr << "Error: Denoise domain must be xyz or spectral." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Denoise: " << denoise << " (" << denoise_domain << ")" << std::endl;
+
+        // LIGHT SAMPLING
+        if (result.count("light-sampling")) light_sampling = result["light-sampling"].as<std::string>();
+        if (light_sampling != "area" && light_sampling != "solid_angle") {
+            std::cerr << "Error: Light sampling must be area or solid_angle." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Light sampling: " << light_sampling << std::endl;
+
+        // LOOKUP TABLE
+        if (result.count("lut-path")) lut_path = result["lut-path"].as<std::string>();
+        if (!lut_path.empty())
+            std::cout << "Lookup table path: " << lut_path << std::endl;
+
+        // UPLIFT
+        if (result.count("uplift")) uplift = result["uplift"].as<std::string>();
+        if (result.count("uplift-model")) uplift_model = result["uplift-model"].as<std::string>();
+        if (uplift != "lut" && uplift != "net") {
+            std::cerr << "Error: Uplift must be lut or net." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Uplift: " << uplift << (uplift == "net" ? " (" + uplift_model + ")" : "") << std::endl;
+
+        // FILM
+        if (result.count("film")) film = result["film"].as<std::string>();
+        if (result.count("film-components")) film_components = result["film-components"].as<int>();
+        if (film != "spectral" && film != "xyz" && film != "pca") {
+            std::cerr << "Error: Film must be spectral, xyz or pca." << std::endl;
+            error = 1;
+            return;
+        }
+        if (film == "xyz" && show_ui) {
+            std::cerr << "Error: The UI shows spectra, so it needs the spectral film." << std::endl;
+            error = 1;
+            return;
+        }
+        if (film == "pca" && (film_components < 3 || film_components > spectrum::RESPONSE_SAMPLES)) {
+            std::cerr << "Error: The pca film needs between 3 and " << spectrum::RESPONSE_SAMPLES << " components." << std::endl;
+            error = 1;
+            return;
+        }
+        std::cout << "Film: " << film << (film == "pca" ? " (" + std::to_string(film_components) + " components)" : "") << std::endl;
     }
 
     std::string get_file_name(int width, int height, int samples, int seconds, bool with_extension = true) const{
@@ -0,0 +1,336 @@
+#pragma once
+#include "image_spd.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+
+// Per pixel feature AOVs gathered while rendering: first hit albedo (reduced
+// to three bands), shading normal and distance, plus the running sums needed
+// for the variance of the pixel mean.
+class FeatureBuffer {
+public:
+    FeatureBuffer(int width, int height)
+        : width_(width), height_(height),
+          albedo_(width * height * 3, 0.0f), normal_(width * height * 3, 0.0f), depth_(width * height, 0.0f),
+          sum_(width * height, 0.0f), sum_sq_(width * height, 0.0f), count_(width * height, 0) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    void clear() {
+        std::fill(albedo_.begin(), albedo_.end(), 0.0f);
+        std::fill(normal_.begin(), normal_.end(), 0.0f);
+        std::fill(depth_.begin(), depth_.end(), 0.0f);
+        std::fill(sum_.begin(), sum_.end(), 0.0f);
+        std::fill(sum_sq_.begin(), sum_sq_.end(), 0.0f);
+        std::fill(count_.begin(), count_.end(), 0);
+    }
+
+    // Features and radiance of one camera sample. Features are averaged over
+    // the samples of the pixel, like the color.
+    void add_sample(int x, int y, const spectrum& albedo, const vec3& normal, double depth, double luminance) {
+        int index = y * width_ + x;
+        spectrum::sample_view data = albedo.get_data();
+        int third = int(data.size()) / 3;
+        for (int band = 0; band < 3; ++band) {
+            int start = band * third;
+            int end = band == 2 ? int(data.size()) : start + third;
+            float sum = 0.0f;
+            for (int i = start; i < end; ++i)
+                sum += data[i];
+            albedo_[index * 3 + band] += sum / (end - start);
+        }
+        for (int c = 0; c < 3; ++c)
+            normal_[index * 3 + c] += normal[c];
+        depth_[index] += depth;
+        sum_[index] += luminance;
+        sum_sq_[index] += luminance * luminance;
+        count_[index] += 1;
+    }
+
+    float albedo(int x, int y, int band) const { return average(albedo_[(y * width_ + x) * 3 + band], x, y); }
+    float normal(int x, int y, int c) const { return average(normal_[(y * width_ + x) * 3 + c], x, y); }
+    float depth(int x, int y) const { return average(depth_[y * width_ + x], x, y); }
+    float mean(int x, int y) const { return average(sum_[y * width_ + x], x, y); }
+
+    // Variance of the pixel mean
+    float variance(int x, int y) const {
+        int index = y * width_ + x;
+        int n = count_[index];
+        if (n < 2)
+            return 0.0f;
+        float m = sum_[index] / n;
+        float sample_variance = std::max(0.0f, (sum_sq_[index] / n - m * m) * n / (n - 1));
+        return sample_variance / n;
+    }
+
+private:
+    int width_;
+    int height_;
+    std::vector<float> albedo_;
+    std::vector<float> normal_;
+    std::vector<float> depth_;
+    std::vector<float> sum_;
+    std::vector<float> sum_sq_;
+    std::vector<int> count_;
+
+    float average(float value, int x, int y) const {
+        int n = count_[y * width_ + x];
+        return n > 0 ? value / n : 0.0f;
+    }
+};
+
+// Joint non-local means filter (Rousselle et al. 2012) on the spectral image.
+// Patch distances come from the color, normalised by the per pixel variance,
+// and are combined with albedo, normal and depth similarity. The weights are
+// either shared by all bands and computed from XYZ, or computed per band.
+class Denoiser {
+public:
+    enum Domain {
+        XYZ,
+        SPECTRAL
+    };
+
+    int search_radius = 5;
+    int patch_radius = 1;
+    float k = 0.45f;              // Color sensitivity
+    float sigma_albedo = 0.1f;
+    float sigma_normal = 0.3f;
+    float sigma_depth = 0.05f;    // Relative to the depth of the center pixel
+
+    static Domain domain_from_string(const std::string& name) {
+        return name == "spectral" ? SPECTRAL : XYZ;
+    }
+
+    void denoise(ImageSPD * image, const FeatureBuffer& features, const observer * observer_ptr, Domain domain) const {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        const int width = image->width();
+        const int height = image->height();
+        // Films are filtered in the channels they store. XYZ and PCA films
+        // get per channel weights for the spectral domain.
+        const int bands = image->channels();
+        const bool xyz_film = image->film() == Image::XYZ;
+
+        // Raw spectral color
+        std::vector<float> radiance(size_t(width) * height * bands);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) {
+                const float* pixel = image->pixel_data(x, y);
+                std::copy(pixel, pixel + bands, radiance.begin() + (size_t(y) * width + x) * bands);
+            }
+
+        // Guide channels used for the patch distance and their variances. The
+        // luminance variance is scaled to each channel by its squared ratio.
+        const int guide_channels = domain == XYZ ? 3 : bands;
+        std::vector<float> guide(size_t(width) * height * guide_channels);
+        std::vector<float> guide_variance(guide.size());
+        parallel_rows(height, [&](int y) {
+            for (int x = 0; x < width; ++x) {
+                size_t pixel = size_t(y) * width + x;
+                float mean = features.mean(x, y);
+                float variance = features.variance(x, y);
+                float* g = guide.data() + pixel * guide_channels;
+                if (domain == XYZ && !xyz_film) {
+                    color xyz = image->get_pixel(x, y).to_XYZ(observer_ptr);
+                    g[0] = xyz.x();
+                    g[1] = xyz.y();
+                    g[2] = xyz.z();
+                } else {
+                    std::copy(radiance.begin() + pixel * bands, radiance.begin() + (pixel + 1) * bands, g);
+                }
+                for (int c = 0; c < guide_channels; ++c) {
+                    float ratio = mean > 0 ? g[c] / mean : 0.0f;
+                    guide_variance[pixel * guide_channels + c] = variance * ratio * ratio;
+                }
+            }
+        });
+
+        // Features scaled by their bandwidths, so the feature distance is half
+        // the squared difference: albedo, normal and depth
+        std::vector<float> scaled_features(size_t(width) * height * FEATURE_CHANNELS);
+        parallel_rows(height, [&](int y) {
+            for (int x = 0; x < width; ++x) {
+                float* f = scaled_features.data() + (size_t(y) * width + x) * FEATURE_CHANNELS;
+                for (int c = 0; c < 3; ++c) {
+                    f[c] = features.albedo(x, y, c) / sigma_albedo;
+                    f[3 + c] = features.normal(x, y, c) / sigma_normal;
+                }
+                f[6] = features.depth(x, y);
+            }
+        });
+
+        std::vector<float> output(radiance.size());
+        const int TILE_SIZE = 64;
+        const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+        const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+        std::atomic<int> next_tile(0);
+
+        auto worker = [&]() {
+            while (true) {
+                int tile = next_tile.fetch_add(1);
+                if (tile >= tiles_x * tiles_y)
+                    break;
+                int x0 = (tile % tiles_x) * TILE_SIZE;
+                int y0 = (tile / tiles_x) * TILE_SIZE;
+                int x1 = std::min(x0 + TILE_SIZE, width);
+                int y1 = std::min(y0 + TILE_SIZE, height);
+                filter_tile(x0, y0, x1, y1, width, height, bands, guide_channels, domain,
+                            radiance, guide, guide_variance, scaled_features, output);
+            }
+        };
+        const int num_threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+            threads.emplace_back(worker);
+        for (auto& thread : threads)
+            thread.join();
+
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) {
+                const float* pixel = output.data() + (size_t(y) * width + x) * bands;
+                std::copy(pixel, pixel + bands, image->pixel_data(x, y));
+            }
+
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time);
+        std::cout << "Denoised " << width << "x" << height << " (" << (domain == XYZ ? "xyz" : "spectral")
+                  << " weights) in " << duration.count() / 1000.0 << " seconds" << std::endl;
+    }
+
+private:
+    static constexpr int FEATURE_CHANNELS = 7;
+
+    static void parallel_rows(int height, const std::function<void(int)>& row) {
+        std::atomic<int> next_row(0);
+        auto worker = [&]() {
+            for (int y = next_row.fetch_add(1); y < height; y = next_row.fetch_add(1))
+                row(y);
+        };
+        const int num_threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+            threads.emplace_back(worker);
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    // Filters the pixels of one tile. For every offset in the search window
+    // the per pixel distances over the tile plus a patch sized border are box
+    // filtered into patch distances, which keeps the cost independent of the
+    // patch size.
+    void filter_tile(int x0, int y0, int x1, int y1, int width, int height, int bands, int guide_channels, Domain domain,
+                     const std::vector<float>& radiance, const std::vector<float>& guide, const std::vector<float>& guide_variance,
+                     const std::vector<float>& scaled_features, std::vector<float>& output) const {
+        const int tile_w = x1 - x0;
+        const int tile_h = y1 - y0;
+        const int border_w = tile_w + 2 * patch_radius;
+        const int border_h = tile_h + 2 * patch_radius;
+        // In spectral mode every band has its own weights
+        const int weight_sets = domain == XYZ ? 1 : bands;
+        const int channels_per_set = domain == XYZ ? guide_channels : 1;
+        const float patch_area = float((2 * patch_radius + 1) * (2 * patch_radius + 1));
+
+        std::vector<float> accumulated(size_t(tile_w) * tile_h * bands, 0.0f);
+        std::vector<float> weight_sum(size_t(tile_w) * tile_h * weight_sets, 0.0f);
+        std::vector<float> distance(size_t(border_w) * border_h);
+        std::vector<float> row_sum(size_t(border_w) * tile_h);
+        std::vector<float> patch(size_t(tile_w) * tile_h);
+        std::vector<float> feature_distance(size_t(tile_w) * tile_h);
+
+        for (int dy = -search_radius; dy <= search_radius; ++dy) {
+            for (int dx = -search_radius; dx <= search_radius; ++dx) {
+                // The feature distance does not depend on the band, so it is shared by all weight sets
+                for (int ty = 0; ty < tile_h; ++ty) {
+                    int py = y0 + ty;
+                    int qy = std::clamp(py + dy, 0, height - 1);
+                    for (int tx = 0; tx < tile_w; ++tx) {
+                        int px = x0 + tx;
+                        int qx = std::clamp(px + dx, 0, width - 1);
+                        const float* fp = scaled_features.data() + (size_t(py) * width + px) * FEATURE_CHANNELS;
+                        const float* fq = scaled_features.data() + (size_t(qy) * width + qx) * FEATURE_CHANNELS;
+                        float d = 0.0f;
+                        for (int c = 0; c < 6; ++c)
+                            d += (fp[c] - fq[c]) * (fp[c] - fq[c]);
+                        float dd = (fp[6] - fq[6]) / (sigma_depth * std::max(fp[6], 1e-3f));
+                        feature_distance[size_t(ty) * tile_w + tx] = 0.5f * (d + dd * dd);
+                    }
+                }
+
+                for (int set = 0; set < weight_sets; ++set) {
+                    // Variance cancelled squared differences between p and q = p + offset
+                    for (int by = 0; by < border_h; ++by) {
+                        int py = std::clamp(y0 + by - patch_radius, 0, height - 1);
+                        int qy = std::clamp(py + dy, 0, height - 1);
+                        for (int bx = 0; bx < border_w; ++bx) {
+                            int px = std::clamp(x0 + bx - patch_radius, 0, width - 1);
+                            int qx = std::clamp(px + dx, 0, width - 1);
+                            size_t p = (size_t(py) * width + px) * guide_channels + set * channels_per_set;
+                            size_t q = (size_t(qy) * width + qx) * guide_channels + set * channels_per_set;
+                            float d = 0.0f;
+                            for (int c = 0; c < channels_per_set; ++c) {
+                                float var_p = guide_variance[p + c];
+                                float var_q = guide_variance[q + c];
+                                float diff = guide[p + c] - guide[q + c];
+                                d += (diff * diff - (var_p + std::min(var_p, var_q))) /
+                                     (1e-10f + k * k * (var_p + var_q) + 1e-4f * (guide[p + c] * guide[p + c]));
+                            }
+                            distance[size_t(by) * border_w + bx] = d / channels_per_set;
+                        }
+                    }
+                    // Separable box filter into patch distances
+                    for (int ty = 0; ty < tile_h; ++ty)
+                        for (int bx = 0; bx < border_w; ++bx) {
+                            float s = 0.0f;
+                            for (int r = 0; r <= 2 * patch_radius; ++r)
+                                s += distance[size_t(ty + r) * border_w + bx];
+                            row_sum[size_t(ty) * border_w + bx] = s;
+                        }
+                    for (int ty = 0; ty < tile_h; ++ty)
+                        for (int tx = 0; tx < tile_w; ++tx) {
+                            float s = 0.0f;
+                            for (int r = 0; r <= 2 * patch_radius; ++r)
+                                s += row_sum[size_t(ty) * border_w + tx + r];
+                            patch[size_t(ty) * tile_w + tx] = s / patch_area;
+                        }
+
+                    for (int ty = 0; ty < tile_h; ++ty) {
+                        int py = y0 + ty;
+                        int qy = py + dy;
+                        if (qy < 0 || qy >= height)
+                            continue;
+                        for (int tx = 0; tx < tile_w; ++tx) {
+                            int px = x0 + tx;
+                            int qx = px + dx;
+                            if (qx < 0 || qx >= width)
+                                continue;
+                            size_t t = size_t(ty) * tile_w + tx;
+                            float w = std::exp(-std::max(0.0f, patch[t]) - feature_distance[t]);
+                            weight_sum[t * weight_sets + set] += w;
+                            const float* q_color = radiance.data() + (size_t(qy) * width + qx) * bands;
+                            float* out = accumulated.data() + t * bands;
+                            if (domain == XYZ) {
+                                for (int b = 0; b < bands; ++b)
+                                    out[b] += w * q_color[b];
+                            } else {
+                                out[set] += w * q_color[set];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        for (int ty = 0; ty < tile_h; ++ty)
+            for (int tx = 0; tx < tile_w; ++tx) {
+                size_t t = size_t(ty) * tile_w + tx;
+                float* out = output.data() + (size_t(y0 + ty) * width + x0 + tx) * bands;
+                for (int b = 0; b < bands; ++b) {
+                    float w = weight_sum[t * weight_sets + (domain == XYZ ? 0 : b)];
+                    out[b] = w > 0 ? accumulated[t * bands + b] / w : 0.0f;
+                }
+            }
+    }
+};
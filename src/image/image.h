@@ -5,13 +5,22 @@
 #include <vector>
 #include "data/color.h"
 #include "data/spectrum.h"
+#include "data/spectral_basis.h"
 #include "data/interval.h"
 class Image {
 public:
-    Image(int width, int height, int num_wavelengths, observer * observer) 
-        : width_(width), height_(height), num_wavelengths_(num_wavelengths), observer_(observer) {
-        row_size_ = width_ * num_wavelengths_;
-        image_buffer_ = std::vector<float>(width * height * num_wavelengths);
+    // What a pixel holds. SPECTRAL keeps every sample for the SPD output and
+    // the spectral graph. XYZ projects samples through the observer as they
+    // are written and keeps 3 floats, for renders that only need the PNG.
+    // PCA keeps the coefficients of a spectral_basis, from which spectra are
+    // rebuilt on demand.
+    enum Film { SPECTRAL, XYZ, PCA };
+
+    Image(int width, int height, int num_wavelengths, const observer * observer, Film film = SPECTRAL, const spectral_basis * basis = nullptr) 
+        : width_(width), height_(height), num_wavelengths_(num_wavelengths), observer_(observer), film_(film), basis_(basis) {
+        channels_ = film_ == XYZ ? 3 : film_ == PCA ? basis_->components() : num_wavelengths_;
+        row_size_ = width_ * channels_;
+        image_buffer_ = std::vector<float>(size_t(width) * height * channels_);
         std::fill(image_buffer_.begin(), image_buffer_.end(), 0.0f);
     }
 
@@ -21,20 +30,73 @@ public:
     virtual void load_spectrum(const char* filename) = 0;
 
     void set_pixel(int x, int y, const spectrum& spectrum) {
-        int index = y * row_size_ + x * num_wavelengths_;
+        float* pixel = pixel_data(x, y);
+        const float* samples = spectrum.get_data().data();
+        if (film_ == XYZ) {
+            color xyz = observer_->to_XYZ(samples);
+            pixel[0] = float(xyz.x());
+            pixel[1] = float(xyz.y());
+            pixel[2] = float(xyz.z());
+            return;
+        }
+        if (film_ == PCA) {
+            basis_->project(samples, pixel);
+            return;
+        }
         for (int i = 0; i < num_wavelengths_; ++i) {
-            image_buffer_[index + i] = spectrum[i];
+            pixel[i] = samples[i];
         }
     }
     void add_to_pixel(int x, int y, const spectrum& spectrum) {
-        int index = y * row_size_ + x * num_wavelengths_;
+        float* pixel = pixel_data(x, y);
+        const float* samples = spectrum.get_data().data();
+        if (film_ == XYZ) {
+            color xyz = observer_->to_XYZ(samples);
+            pixel[0] += float(xyz.x());
+            pixel[1] += float(xyz.y());
+            pixel[2] += float(xyz.z());
+            return;
+        }
+        if (film_ == PCA) {
+            float coefficients[spectrum::RESPONSE_SAMPLES];
+            basis_->project(samples, coefficients);
+            for (int k = 0; k < channels_; ++k)
+                pixel[k] += coefficients[k];
+            return;
+        }
         for (int i = 0; i < num_wavelengths_; ++i) {
-            image_buffer_[index + i] += spectrum[i];
+            pixel[i] += samples[i];
         }
     }
+    // The stored spectrum, rebuilt from its coefficients on a PCA film. On an
+    // XYZ film it is uplifted from the pixel's linear RGB; colours brighter
+    // than white are uplifted at unit peak and scaled back up, as the lookup
+    // table only covers the unit cube.
     spectrum get_pixel(int x, int y) const {
-        int index = y * row_size_ + x * num_wavelengths_;
-        return spectrum(image_buffer_.data() + index);
+        const float* pixel = pixel_data(x, y);
+        if (film_ == SPECTRAL)
+            return spectrum(pixel);
+        if (film_ == PCA)
+            return basis_->reconstruct(pixel);
+        color rgb = color(pixel[0], pixel[1], pixel[2], color::ColorSpace::XYZ).to_rgb();
+        float peak = float(std::max(rgb.x(), std::max(rgb.y(), rgb.z())));
+        if (peak <= 1.0f)
+            return spectrum(rgb);
+        return spectrum(color(rgb.x() / peak, rgb.y() / peak, rgb.z() / peak)) * peak;
+    }
+
+    // Raw channels of a pixel, channels() floats in the layout of the film
+    float* pixel_data(int x, int y) {
+        return image_buffer_.data() + size_t(y) * row_size_ + size_t(x) * channels_;
+    }
+    const float* pixel_data(int x, int y) const {
+        return image_buffer_.data() + size_t(y) * row_size_ + size_t(x) * channels_;
+    }
+    // Copies a pixel of an image with the same film and basis without going
+    // through a spectrum
+    void copy_pixel(int x, int y, const Image& source, int source_x, int source_y) {
+        const float* pixel = source.pixel_data(source_x, source_y);
+        std::copy(pixel, pixel + channels_, pixel_data(x, y));
     }
 
     // RGB 
@@ -59,6 +121,42 @@ public:
         return get_pixel(x, y).to_rgb(observer_);
     }
 
+    // XYZ of a whole row, as width consecutive triples
+    void get_row_XYZ(int y, float* xyz) const {
+        get_row_XYZ(y, observer_, xyz);
+    }
+    // The same through another observer, as picked in the UI. An XYZ film
+    // was integrated when it was written and keeps its own observer.
+    void get_row_XYZ(int y, const observer * obs, float* xyz) const {
+        const float* row = image_buffer_.data() + size_t(y) * row_size_;
+        if (film_ == XYZ) {
+            std::copy(row, row + row_size_, xyz);
+            return;
+        }
+        if (film_ == PCA) {
+            // XYZ of every component, so pixels need no spectra rebuilt
+            std::vector<float> basis_xyz(size_t(channels_) * 3);
+            for (int k = 0; k < channels_; ++k) {
+                color component = obs->to_XYZ(basis_->row(k));
+                basis_xyz[k * 3 + 0] = float(component.x());
+                basis_xyz[k * 3 + 1] = float(component.y());
+                basis_xyz[k * 3 + 2] = float(component.z());
+            }
+            for (int x = 0; x < width_; ++x) {
+                const float* pixel = row + size_t(x) * channels_;
+                float* out = xyz + x * 3;
+                out[0] = out[1] = out[2] = 0.0f;
+                for (int k = 0; k < channels_; ++k) {
+                    out[0] += pixel[k] * basis_xyz[k * 3 + 0];
+                    out[1] += pixel[k] * basis_xyz[k * 3 + 1];
+                    out[2] += pixel[k] * basis_xyz[k * 3 + 2];
+                }
+            }
+            return;
+        }
+        obs->to_XYZ(row, num_wavelengths_, width_, xyz);
+    }
+
     float max_value() const {
         float max_value = 0.0f;
         for (const auto& value : image_buffer_) {
@@ -86,14 +184,21 @@ public:
     int width() const { return width_; }
     int height() const { return height_; }
     int num_wavelengths() const { return num_wavelengths_; }
+    Film film() const { return film_; }
+    const spectral_basis * basis() const { return basis_; }
+    int channels() const { return channels_; }
+    size_t memory_size() const { return image_buffer_.size() * sizeof(float); }
 
 protected:
     int width_;
     int height_;
     int num_wavelengths_;
+    int channels_;
     int row_size_;
     std::vector<float> image_buffer_;
-    observer * observer_;
+    const observer * observer_;
+    Film film_;
+    const spectral_basis * basis_;
 };
 
 #endif // IMAGE_H
\ No newline at end of file
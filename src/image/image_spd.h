@@ -1,17 +1,18 @@
 #pragma once
 #include "image.h"
+#include "../data/spectral_net.h"
 #include <png.h>
 #include <vector>
 #include <cstdio>
 
 class ImageSPD : public Image {
 public:
-    ImageSPD(int width, int height, int num_wavelengths, observer * observer) 
-        : Image(width, height, num_wavelengths, observer) {}
+    ImageSPD(int width, int height, int num_wavelengths, const observer * observer, Film film = SPECTRAL, const spectral_basis * basis = nullptr) 
+        : Image(width, height, num_wavelengths, observer, film, basis) {}
 
     ~ImageSPD() override = default;
     
-    static ImageSPD load(const char* filename, observer * obs) {
+    static ImageSPD load(const char* filename, const observer * obs) {
         FILE* file = fopen(filename, "rb");
         if (!file) {
             throw std::runtime_error("Failed to open the PNG file for reading");
@@ -76,15 +77,18 @@ public:
 
         ImageSPD image(width, height, spectrum::RESPONSE_SAMPLES, obs);
 
-        // Convert pixel by pixel to spectrum
+        // Convert a scanline at a time, so a spectral model can batch it
+        std::vector<color> colors(width);
+        std::vector<spectrum> spectra(width);
         for (int y = 0; y < height; y++) {
             png_bytep row = row_pointers[y];
             for (int x = 0; x < width; x++) {
                 png_bytep px = &(row[x * 4]);
-                color rgb(px[0] / 255.0, px[1] / 255.0, px[2] / 255.0);
-                spectrum s = spectrum(rgb);
-                image.set_pixel(x, y, s);
+                colors[x] = color(px[0] / 255.0, px[1] / 255.0, px[2] / 255.0);
             }
+            spectral_net::uplift(colors.data(), width, spectra.data());
+            for (int x = 0; x < width; x++)
+                image.set_pixel(x, y, spectra[x]);
         }
 
         for (int y = 0; y < height; y++) {
@@ -100,6 +104,10 @@ public:
         return get_pixel(u * width_, v * height_);
     }  
     void save_spectrum(const char* filename) override {
+        if (film_ == XYZ) {
+            printf("The XYZ film holds no spectra, not writing %s\n", filename);
+            return;
+        }
 
         // Get file pointer for writing
         FILE* file = fopen(filename, "wb");
@@ -108,12 +116,16 @@ public:
             return;
         }
 
-        // Write resolution in binary format
+        // Write the header and resolution in binary format
+        fwrite(&SPD_MAGIC, sizeof(int), 1, file);
+        fwrite(&SPD_VERSION, sizeof(int), 1, file);
         fwrite(&width_, sizeof(int), 1, file);
         fwrite(&height_, sizeof(int), 1, file);
         fwrite(&gamma_, sizeof(float), 1, file);
         fwrite(&exposure_, sizeof(float), 1, file);
         fwrite(&spectrum::RESPONSE_SAMPLES, sizeof(int), 1, file);
+        fwrite(&spectrum::START_WAVELENGTH, sizeof(float), 1, file);
+        fwrite(&spectrum::END_WAVELENGTH, sizeof(float), 1, file);
 
         fwrite(&render_mode_, sizeof(int), 1, file);
         fwrite(&light_source_, sizeof(int), 1, file);
@@ -123,6 +135,17 @@ public:
         fwrite(&samples_, sizeof(int), 1, file);
         fwrite(&depth_, sizeof(int), 1, file);
 
+        // A PCA film writes its basis and the coefficients of every pixel
+        int components = film_ == PCA ? channels_ : 0;
+        fwrite(&components, sizeof(int), 1, file);
+        if (film_ == PCA) {
+            for (int k = 0; k < components; k++)
+                fwrite(basis_->row(k), sizeof(float), spectrum::RESPONSE_SAMPLES, file);
+            fwrite(image_buffer_.data(), sizeof(float), image_buffer_.size(), file);
+            fclose(file);
+            return;
+        }
+
         // Write the SPD data to the file
         for (int y = 0; y < height_; y++) {
             for (int x = 0; x < width_; x++) {
@@ -137,7 +160,10 @@ public:
     void load_from_spd_image(ImageSPD * image) {
         for (int y = 0; y < height_; y++) {
             for (int x = 0; x < width_; x++) {
-                set_pixel(x, y, image->get_pixel(x, y));
+                if (image->film() == film_ && image->basis() == basis_)
+                    copy_pixel(x, y, *image, x, y);
+                else
+                    set_pixel(x, y, image->get_pixel(x, y));
             }
         }
     }
@@ -149,39 +175,120 @@ public:
             return;
         }
 
-        fread(&width_, sizeof(int), 1, file);
-        fread(&height_, sizeof(int), 1, file);
-        fread(&gamma_, sizeof(float), 1, file);
-        fread(&exposure_, sizeof(float), 1, file);
-        fread(&num_wavelengths_, sizeof(int), 1, file);
-
-        fread(&render_mode_, sizeof(int), 1, file);
-        fread(&light_source_, sizeof(int), 1, file);
-        fread(&observer_type_, sizeof(int), 1, file);
-        fread(&spectrum_type_, sizeof(int), 1, file);
+        // Every read is checked, and the image is only resized once the
+        // header has been validated
+        bool complete = true;
+        auto read = [&](void* data, size_t size, size_t count) {
+            complete = complete && fread(data, size, count, file) == count;
+        };
+
+        // Files without the magic number start with the width and were
+        // written with 31 samples from 400 to 700nm
+        int magic = 0;
+        read(&magic, sizeof(int), 1);
+        int version = 0;
+        int width = 0, height = 0;
+        if (magic == SPD_MAGIC) {
+            read(&version, sizeof(int), 1);
+            read(&width, sizeof(int), 1);
+        } else {
+            width = magic;
+        }
+        read(&height, sizeof(int), 1);
+        float gamma = gamma_, exposure = exposure_;
+        read(&gamma, sizeof(float), 1);
+        read(&exposure, sizeof(float), 1);
+        int file_samples = 31;
+        float file_start = 400.0f;
+        float file_end = 700.0f;
+        read(&file_samples, sizeof(int), 1);
+        if (version >= 2) {
+            read(&file_start, sizeof(float), 1);
+            read(&file_end, sizeof(float), 1);
+        }
+        bool same_layout = file_samples == spectrum::RESPONSE_SAMPLES && file_start == spectrum::START_WAVELENGTH && file_end == spectrum::END_WAVELENGTH;
+        if (!same_layout) {
+            std::cout << "Resampling SPD file from " << file_samples << " samples over " << file_start << "-" << file_end << "nm to "
+                      << spectrum::RESPONSE_SAMPLES << " samples over " << spectrum::START_WAVELENGTH << "-" << spectrum::END_WAVELENGTH << "nm" << std::endl;
+        }
 
-        fread(&samples_, sizeof(int), 1, file);
-        fread(&depth_, sizeof(int), 1, file);
+        read(&render_mode_, sizeof(int), 1);
+        read(&light_source_, sizeof(int), 1);
+        read(&observer_type_, sizeof(int), 1);
+        read(&spectrum_type_, sizeof(int), 1);
+
+        read(&samples_, sizeof(int), 1);
+        read(&depth_, sizeof(int), 1);
+
+        // Version 3 files of a PCA film hold a basis and coefficients per pixel
+        int components = 0;
+        if (version >= 3)
+            read(&components, sizeof(int), 1);
+        if (!complete || version > SPD_VERSION || width <= 0 || height <= 0 || file_samples < 2 || file_samples > 4096 ||
+            components < 0 || components > file_samples) {
+            printf("Not a valid SPD file: %s\n", filename);
+            fclose(file);
+            return;
+        }
+        // The basis and pixels have to fit in what is left of the file before
+        // any memory is set aside for them. Counted in double, as a corrupt
+        // size can overflow size_t.
+        long header_end = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long file_end_offset = ftell(file);
+        fseek(file, header_end, SEEK_SET);
+        double needed = (double(components) * file_samples + double(width) * height * (components > 0 ? components : file_samples)) * sizeof(float);
+        if (header_end < 0 || needed > double(file_end_offset - header_end)) {
+            printf("SPD file %s is truncated or its size is corrupt\n", filename);
+            fclose(file);
+            return;
+        }
+        gamma_ = gamma;
+        exposure_ = exposure;
+        std::vector<float> basis(size_t(components) * file_samples);
+        read(basis.data(), sizeof(float), basis.size());
+        width_ = width;
+        height_ = height;
+        num_wavelengths_ = spectrum::RESPONSE_SAMPLES;
 
         // Make the image buffer the correct size
-        row_size_ = width_ * num_wavelengths_;
-        image_buffer_ = std::vector<float>(width_ * height_ * num_wavelengths_ );
+        row_size_ = width_ * channels_;
+        image_buffer_ = std::vector<float>(size_t(width_) * height_ * channels_);
         std::fill(image_buffer_.begin(), image_buffer_.end(), 0.0f);
 
         // Read the SPD data from the file
         for (int y = 0; y < height_; y++) {
             for (int x = 0; x < width_; x++) {
-                std::vector<float> pixel_data(num_wavelengths_);
-                fread(pixel_data.data(), sizeof(float), num_wavelengths_, file);
-                spectrum spectrum(pixel_data);
-                set_pixel(x, y, spectrum);
+                std::vector<float> pixel_data(file_samples);
+                if (components > 0) {
+                    std::vector<float> coefficients(components);
+                    read(coefficients.data(), sizeof(float), components);
+                    for (int k = 0; k < components; k++)
+                        for (int i = 0; i < file_samples; i++)
+                            pixel_data[i] += coefficients[k] * basis[size_t(k) * file_samples + i];
+                } else {
+                    read(pixel_data.data(), sizeof(float), file_samples);
+                }
+                if (same_layout)
+                    set_pixel(x, y, spectrum(pixel_data));
+                else
+                    set_pixel(x, y, spectrum::resampled(pixel_data.data(), file_samples, file_start, file_end));
             }
         }
+        if (!complete)
+            printf("SPD file %s could not be read to the end, the missing pixels are black\n", filename);
         std::cout << "Loaded SPD file with width: " << width_ << " and height: " << height_ << std::endl;
         std::cout << "Loaded SPD file with exposure: " << exposure_ << " and gamma: " << gamma_ << std::endl;
         fclose(file);
     }
 
+    // "RSPD" in little endian, followed by the format version. Version 2
+    // records the spectral layout after the sample count. Version 3 adds the
+    // number of basis components after the depth, 0 when every sample is
+    // stored, otherwise followed by the basis rows and the coefficients.
+    static constexpr int SPD_MAGIC = 0x44505352;
+    static constexpr int SPD_VERSION = 3;
+
     float exposure_ = 1.0f;
     float gamma_ = 2.2f;
     int samples_ = 1024;
@@ -195,18 +302,24 @@ public:
         std::cout << "Saving image to " << filename << " with gamma:" << gamma << " and exposure:" << exposure << std::endl;
         std::vector<png_byte> png_buffer(height_ * width_ * 3);
         static const interval intensity(0.000, 0.999);
+        const double exposure_scale = std::pow(2.0, exposure);
 
+        // Rows are converted to XYZ and gamma corrected at once
+        std::vector<float> xyz_row(width_ * 3);
+        std::vector<float> linear_row(width_ * 3);
         for (int y = 0; y < height_; y++) {
             png_bytep row = png_buffer.data() + y * width_ * 3;
+            get_row_XYZ(y, xyz_row.data());
             for (int x = 0; x < width_; x++) {
-                png_bytep pixel = row + x * 3;
-                spectrum spectrum = get_pixel(x, y) * std::pow(2.0, exposure);
-                color rgb = spectrum.to_rgb(observer_);
-
-                pixel[0] = int(255.999 * intensity.clamp(linear_to_gamma2(rgb.x(), gamma))); // Red channel
-                pixel[1] = int(255.999 * intensity.clamp(linear_to_gamma2(rgb.y(), gamma))); // Green channel
-                pixel[2] = int(255.999 * intensity.clamp(linear_to_gamma2(rgb.z(), gamma))); // Blue channel
+                color xyz(xyz_row[x * 3 + 0] * exposure_scale, xyz_row[x * 3 + 1] * exposure_scale, xyz_row[x * 3 + 2] * exposure_scale, color::ColorSpace::XYZ);
+                color rgb = xyz.to_rgb();
+                linear_row[x * 3 + 0] = float(rgb.x());
+                linear_row[x * 3 + 1] = float(rgb.y());
+                linear_row[x * 3 + 2] = float(rgb.z());
             }
+            fast_pow(linear_row.data(), 1.0f / gamma, linear_row.data(), width_ * 3);
+            for (int i = 0; i < width_ * 3; i++)
+                row[i] = int(255.999 * intensity.clamp(linear_row[i]));
         }
 
         // Create the PNG file
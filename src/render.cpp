@@ -5,13 +5,22 @@
 render::render(settings * settings, rd::usd::loader * loader) : QObject() { 
     settings_ptr = settings;
     load_lookup_table();
+    if (settings_ptr->uplift == "net" && !spectral_net::use(settings_ptr->uplift_model))
+        std::cerr << "Falling back to the lookup table for uplifting" << std::endl;
 
     // Initialize SpectralConverter
-    observer_ptr = new observer(observer::CIE1931_2Deg, spectrum::RESPONSE_SAMPLES, spectrum::START_WAVELENGTH, spectrum::END_WAVELENGTH);
+    observer_ptr = observer::get(observer::CIE1931_2Deg);
 
 
     // IMAGE
-    image_buffer = new ImageSPD(settings_ptr->image_width, settings_ptr->image_height, spectrum::RESPONSE_SAMPLES, observer_ptr);
+    film = settings_ptr->film == "xyz" ? Image::XYZ : settings_ptr->film == "pca" ? Image::PCA : Image::SPECTRAL;
+    if (film == Image::PCA) {
+        film_basis = new spectral_basis(settings_ptr->film_components, observer_ptr);
+        film_basis->report(std::cout);
+    }
+    image_buffer = new ImageSPD(settings_ptr->image_width, settings_ptr->image_height, spectrum::RESPONSE_SAMPLES, observer_ptr, film, film_basis);
+    std::cout << "Image buffer: " << image_buffer->channels() << " floats per pixel, "
+              << image_buffer->memory_size() / (1024.0 * 1024.0) << " MB" << std::endl;
     if(settings_ptr->spd_file != "") {
         image_buffer->load_spectrum(settings_ptr->spd_file.c_str());
     }
@@ -49,7 +58,7 @@ render::render(settings * settings, rd::usd::loader * loader) : QObject() {
     
     // LOAD AREA LIGHTS
     std::cout << "Loading area lights from USD stage" << std::endl;
-    std::vector<rd::core::area_light*> area_lights = rd::usd::light::extractAreaLightsFromUsdStage(loader->get_stage(), observer_ptr);
+    std::vector<rd::core::area_light*> area_lights = rd::usd::light::extractAreaLightsFromUsdStage(loader->get_stage(), observer_ptr, settings_ptr->light_sampling);
 
     for(const auto& light : area_lights){
          world->add(light);
@@ -58,6 +67,22 @@ render::render(settings * settings, rd::usd::loader * loader) : QObject() {
 
     samples_per_pixel = settings_ptr->samples;
     max_depth = settings_ptr->max_depth;
+    restir_direct = settings_ptr->restir;
+    path_splits = settings_ptr->split;
+
+    // Triangles of emissive meshes are sampled as lights as well
+    int emissive_triangles = 0;
+    for (rd::core::mesh* mesh : scene_meshes) {
+        for (const triangle& tri : mesh->triangles) {
+            if (tri.get_material() && tri.get_material()->emission_power() > 0) {
+                lights->add(new rd::core::triangle_light(tri));
+                emissive_triangles++;
+            }
+        }
+    }
+    std::cout << "Emissive triangles: " << emissive_triangles << std::endl;
+    std::cout << "Building light BVH" << std::endl;
+    light_sampler = new light_bvh(lights);
 
     std::cout << "Scene meshes size: " << scene_meshes.size() << std::endl;
     std::cout << "Depth: " << max_depth << std::endl;
@@ -77,6 +102,30 @@ render::render(settings * settings, rd::usd::loader * loader) : QObject() {
     std::cout << "Building BVH" << std::endl;
     auto bvh_shared = new bvh_node(world);
     world = new hittable_list(bvh_shared);
+
+    if (settings_ptr->guiding) {
+        aabb guiding_bounds = world->bounding_box();
+        guiding_bounds.pad(0.001);
+        guiding = new sd_tree(guiding_bounds, settings_ptr->guiding_memory);
+    }
+
+    filter = new pixel_filter(pixel_filter::type_from_string(settings_ptr->filter));
+
+    if (settings_ptr->blue_noise) {
+        blue_noise = new dithering();
+    }
+
+    if (settings_ptr->fast_cache_memory > 0) {
+        fast_cache = new radiance_cache(0.005 * world->bounding_box().size().length(), settings_ptr->fast_cache_memory);
+    }
+
+    if (settings_ptr->photons > 0) {
+        caustics = new photon_map();
+        photon_radius = settings_ptr->photon_radius;
+        if (photon_radius <= 0)
+            photon_radius = 0.002 * world->bounding_box().size().length();
+        std::cout << "Photon gather radius: " << photon_radius << std::endl;
+    }
 }
 void render::render_scene_slot() {
 
@@ -90,17 +139,21 @@ int render::render_scene() {
 
     std::cout << "Rendering scene" << std::endl;
     int seconds_to_render = mtpool_bucket_prog_render();
+    image_buffer->samples_ = rendered_samples;
 
     // Save the image with the new file name
     // image_buffer->normalize();
     image_buffer->save(
-        settings_ptr->get_file_name(image_buffer->width(),image_buffer->height(), settings_ptr->samples, seconds_to_render).c_str(),
+        settings_ptr->get_file_name(image_buffer->width(),image_buffer->height(), rendered_samples, seconds_to_render).c_str(),
         settings_ptr->gamma, settings_ptr->exposure);
     if(!in_ui_mode) {
         std::cout << "Finished rendering" << std::endl;
+        // The XYZ film has no spectra to write
+        if (film == Image::XYZ)
+            return seconds_to_render;
         image_buffer->exposure_ = settings_ptr->exposure;
         image_buffer->gamma_ = settings_ptr->gamma;
-        auto file_name = settings_ptr->get_file_name(image_buffer->width(),image_buffer->height(), settings_ptr->samples, seconds_to_render, false);
+        auto file_name = settings_ptr->get_file_name(image_buffer->width(),image_buffer->height(), rendered_samples, seconds_to_render, false);
         file_name += ".spd";
         image_buffer->save_spectrum(file_name.c_str());
     }
@@ -109,20 +162,301 @@ int render::render_scene() {
 
 
 int render::mtpool_bucket_prog_render() {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    render_start = start_time;
+
+    // Emitter power changed, so the light BVH importance is rebuilt and
+    // radiance cached under the old emission is dropped
+    if (lights_changed.exchange(false)) {
+        light_sampler->build(lights);
+        if (fast_cache)
+            fast_cache->clear();
+    }
+
+    // Features are gathered from the final pass only
+    delete features;
+    features = nullptr;
+    if (guiding && !fast_render) {
+        train_guiding();
+    }
+    if (settings_ptr->denoise) {
+        features = new FeatureBuffer(image_buffer->width(), image_buffer->height());
+    }
+
     initialize();
+#ifdef RAYDAR_SPECTRUM_STATS
+    spectrum_stats::get().reset();
+#endif
+    bool budgeted = settings_ptr->time_limit > 0 || settings_ptr->target_noise > 0;
+    ProgressBar progress_bar(budgeted ? BUDGET_PROGRESS_STEPS : samples_per_pixel);
+    if ((caustics && !fast_render) || budgeted) {
+        render_passes(&progress_bar);
+    } else {
+        render_buckets(&progress_bar);
+        rendered_samples = samples_per_pixel;
+    }
+
+    if (features) {
+        std::cout << std::endl;
+        Denoiser denoiser;
+        denoiser.denoise(image_buffer, *features, observer_ptr, Denoiser::domain_from_string(settings_ptr->denoise_domain));
+        emit_bucket(Bucket{0, 0, image_buffer->width(), image_buffer->height()});
+    }
+
+    std::cout << std::endl;
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
+    std::cout << "Rendering time: " << duration.count() << " seconds" << std::endl;
+#ifdef RAYDAR_SPECTRUM_STATS
+    spectrum_stats::get().report(std::cout);
+#endif
+    return duration.count();
+}
+void render::train_guiding() {
+    // Training passes double their sample count each iteration and together
+    // take about half of the final sample budget. The tree is frozen for the
+    // final pass so it is no longer written to.
+    const int final_samples = samples_per_pixel;
+    guiding->reset();
+    int spent_samples = 0;
+    for (int iteration = 0; iteration == 0 || spent_samples < final_samples / 2; ++iteration) {
+        samples_per_pixel = 1 << iteration;
+        initialize();
+        std::cout << "Path guiding training pass " << iteration << " with " << samples_per_pixel << " samples" << std::endl;
+        render_buckets(nullptr);
+        guiding->refine(iteration);
+        spent_samples += samples_per_pixel;
+    }
+    guiding->freeze();
+    samples_per_pixel = final_samples;
+}
+void render::render_passes(ProgressBar * progress_bar) {
+    // Passes are averaged into one image, weighted by their sample counts.
+    // With photon mapping every pass traces a fresh photon map with a smaller
+    // gather radius, so the caustic bias vanishes as passes are added (Knaus
+    // and Zwicker 2011). With a time or noise budget, passes of --samples each
+    // continue until the budget is met instead of splitting --samples.
+    const int final_samples = samples_per_pixel;
+    const bool budgeted = settings_ptr->time_limit > 0 || settings_ptr->target_noise > 0;
+    const bool use_photons = caustics && !fast_render;
+    const int passes = budgeted ? MAX_PROGRESSIVE_PASSES : std::min(settings_ptr->photon_passes, final_samples);
+    const int width = image_buffer->width();
+    const int height = image_buffer->height();
+
+    ImageSPD accumulated(width, height, spectrum::RESPONSE_SAMPLES, observer_ptr, film, film_basis);
+    // Per pixel sums of the pass luminance for the noise estimate
+    std::vector<double> luminance_sum(budgeted ? width * height : 0, 0.0);
+    std::vector<double> luminance_sum_sq(budgeted ? width * height : 0, 0.0);
+    double accumulated_samples = 0.0;
+    double radius = photon_radius;
+    for (int pass = 0; pass < passes; ++pass) {
+        auto pass_start = std::chrono::high_resolution_clock::now();
+        pass_index = pass;
+        samples_per_pixel = budgeted ? final_samples : final_samples / passes + (pass < final_samples % passes ? 1 : 0);
+        initialize();
+        if (use_photons) {
+            std::cout << "Photon pass " << pass << " with radius " << radius << std::endl;
+            trace_photons(settings_ptr->photons, radius);
+            radius *= std::sqrt((pass + 1 + PHOTON_RADIUS_ALPHA) / (pass + 2));
+        }
+        // Budgeted passes report the spent budget once they finish instead
+        render_buckets(!budgeted && pass == passes - 1 ? progress_bar : nullptr);
+
+        double pass_samples = samples_per_pixel;
+        double pass_weight = pass_samples / (accumulated_samples + pass_samples);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const float* pass_color = image_buffer->pixel_data(x, y);
+                float* blended = accumulated.pixel_data(x, y);
+                for (int c = 0; c < accumulated.channels(); ++c)
+                    blended[c] = float(blended[c] * (1.0 - pass_weight) + pass_color[c] * pass_weight);
+                if (budgeted) {
+                    double luminance = film == Image::XYZ ? pass_color[1] : image_buffer->get_pixel(x, y).average();
+                    luminance_sum[y * width + x] += luminance;
+                    luminance_sum_sq[y * width + x] += luminance * luminance;
+                }
+            }
+        }
+        accumulated_samples += pass_samples;
+        image_buffer->load_from_spd_image(&accumulated);
+        emit_bucket(Bucket{0, 0, width, height});
+
+        if (!budgeted)
+            continue;
+
+        // Relative RMS error of the image, from the spread of the passes around their mean
+        double noise = infinity;
+        int n = pass + 1;
+        if (n > 1) {
+            double variance_sum = 0.0, signal_sum = 0.0;
+            for (size_t i = 0; i < luminance_sum.size(); ++i) {
+                double mean = luminance_sum[i] / n;
+                double variance = std::max(0.0, luminance_sum_sq[i] / n - mean * mean) / (n - 1);
+                variance_sum += variance;
+                signal_sum += mean * mean;
+            }
+            noise = signal_sum > 0 ? std::sqrt(variance_sum / signal_sum) : 0.0;
+        }
+
+        auto now = std::chrono::high_resolution_clock::now();
+        double elapsed = std::chrono::duration<double>(now - render_start).count();
+        double pass_seconds = std::chrono::duration<double>(now - pass_start).count();
+        std::cout << std::endl << "Pass " << pass << ": " << accumulated_samples << " spp, noise " << noise
+                  << ", " << elapsed << " seconds" << std::endl;
+
+        bool done = (settings_ptr->target_noise > 0 && noise <= settings_ptr->target_noise) ||
+                    // Stop when another pass of the same length would not fit
+                    (settings_ptr->time_limit > 0 && elapsed + pass_seconds > settings_ptr->time_limit);
+
+        // Spent budget, of time or of samples: noise falls as one over the
+        // square root of the samples, so the target takes (noise / target)^2
+        // times the samples so far
+        double spent = 0.0;
+        if (settings_ptr->time_limit > 0)
+            spent = elapsed / settings_ptr->time_limit;
+        if (settings_ptr->target_noise > 0 && noise > 0)
+            spent = std::max(spent, std::pow(settings_ptr->target_noise / noise, 2.0));
+        int progress = done ? BUDGET_PROGRESS_STEPS : int(std::min(spent, 1.0) * BUDGET_PROGRESS_STEPS);
+        if (progress_bar) {
+            progress_bar->update(progress);
+            updateProgress(progress, BUDGET_PROGRESS_STEPS);
+        }
+        if (done)
+            break;
+    }
+    rendered_samples = int(accumulated_samples);
+    pass_index = 0;
+    samples_per_pixel = final_samples;
+    initialize();
+}
+void render::trace_photons(int count, double radius) {
+    // Lights are picked in proportion to their power
+    std::vector<hittable*> emitters;
+    std::vector<double> cdf;
+    double total_power = 0.0;
+    for (hittable* light : *lights->objects) {
+        double power = light->get_light_bounds().phi;
+        if (power <= 0)
+            continue;
+        total_power += power;
+        emitters.push_back(light);
+        cdf.push_back(total_power);
+    }
+    if (emitters.empty()) {
+        caustics->build({}, radius);
+        return;
+    }
+
     auto start_time = std::chrono::high_resolution_clock::now();
+    const int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::vector<photon>> thread_photons(num_threads);
+    auto worker = [&](int thread_index, int begin, int end) {
+        std::vector<photon>& stored = thread_photons[thread_index];
+        for (int n = begin; n < end; ++n) {
+            int light_index = int(std::lower_bound(cdf.begin(), cdf.end(), random_double() * total_power) - cdf.begin());
+            light_index = std::min(light_index, int(emitters.size()) - 1);
+            hittable* light = emitters[light_index];
+            double light_probability = (cdf[light_index] - (light_index > 0 ? cdf[light_index - 1] : 0.0)) / total_power;
+
+            hit_record light_rec;
+            double pdf_area = light->sample_emission(light_rec);
+            if (pdf_area <= 0)
+                continue;
+
+            // Each photon carries one wavelength band. Directions follow the
+            // emitted cos^n falloff times the projected area cosine, whose
+            // integral over the hemisphere, 2 pi / (n + 2), scales the power.
+            int band = random_int(0, spectrum::RESPONSE_SAMPLES - 1);
+            ray to_light(light_rec.p + light_rec.normal, -light_rec.normal);
+            spectrum emission = light_rec.mat->emitted(to_light, light_rec, light_rec.u, light_rec.v, light_rec.p);
+            double exponent = light_rec.mat->emission_exponent();
+            float power = emission[band] * (2 * pi / (exponent + 2)) * spectrum::RESPONSE_SAMPLES / (light_probability * pdf_area * count);
+            if (power <= 0)
+                continue;
+
+            onb uvw(light_rec.normal);
+            ray r(light_rec.p, uvw.transform(random_cosine_power_direction(exponent + 1)));
+            r.wavelength = spectrum::START_WAVELENGTH + band * (spectrum::END_WAVELENGTH - spectrum::START_WAVELENGTH) / (spectrum::RESPONSE_SAMPLES - 1);
+
+            // Only paths that pass at least one specular surface before landing
+            // on a diffuse one are caustics, everything else is left to the path tracer.
+            bool after_specular = false;
+            for (int depth = 0; depth < max_depth; ++depth) {
+                hit_record rec;
+                if (!world->hit(r, interval(0.001, infinity), rec))
+                    break;
+                if (!rec.mat->is_visible()) {
+                    const double bias = 0.0001;
+                    float wavelength = r.wavelength;
+                    r = ray(rec.p + bias * r.direction(), r.direction(), r.get_depth());
+                    r.wavelength = wavelength;
+                    continue;
+                }
+
+                scatter_record srec;
+                if (!rec.mat->scatter(r, rec, srec))
+                    break;
+                if (!srec.skip_pdf && srec.lobe == LOBE_DIFFUSE) {
+                    delete srec.pdf_ptr;
+                    if (after_specular)
+                        stored.push_back({rec.p, -unit_vector(r.direction()), power, band});
+                    break;
+                }
+
+                // Glossy lobes scatter the photon through their own pdf
+                ray next = srec.skip_pdf_ray;
+                if (!srec.skip_pdf) {
+                    next = ray(rec.p, srec.pdf_ptr->generate(), r.get_depth() + 1);
+                    double pdf_val = srec.pdf_ptr->value(next.direction());
+                    delete srec.pdf_ptr;
+                    power *= pdf_val > 0 ? float(rec.mat->scattering_pdf(r, rec, next, srec.lobe) / pdf_val) : 0.0f;
+                }
+
+                power *= srec.attenuation[band];
+                if (power <= 0)
+                    break;
+                after_specular = true;
+                float wavelength = r.wavelength;
+                r = next;
+                r.wavelength = wavelength;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back(worker, t, int(int64_t(count) * t / num_threads), int(int64_t(count) * (t + 1) / num_threads));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<photon> all_photons;
+    for (auto& stored : thread_photons) {
+        all_photons.insert(all_photons.end(), stored.begin(), stored.end());
+    }
+    size_t stored_count = all_photons.size();
+    caustics->build(std::move(all_photons), radius);
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time);
+    std::cout << "Traced " << count << " photons, stored " << stored_count << " caustic photons in " << duration.count() / 1000.0 << " seconds" << std::endl;
+}
+void render::render_buckets(ProgressBar * progress_bar) {
     const int num_threads = std::thread::hardware_concurrency();
     std::vector<std::thread> threads(num_threads);
     std::atomic<int> next_bucket(0);
     std::atomic<int> buckets_completed(0);
-    std::atomic<bool> done(false);
-    const int total_samples = sqrt_spp * sqrt_spp;
-    ProgressBar progress_bar(total_samples);
-    
+    const int total_samples = samples_per_pixel;
+
     std::cout << "Rendering with " << num_threads  << " threads" << std::endl;
     // Calculate total buckets
     const int total_buckets = ((image_buffer->width() + BUCKET_SIZE - 1) / BUCKET_SIZE) *
                                 ((image_buffer->height() + BUCKET_SIZE - 1) / BUCKET_SIZE);
+    // Reset and sized here, before the workers start, as buckets write into it in place
+    if (restir_reset.exchange(false))
+        restir_history.clear();
+    if (restir_direct)
+        restir_history.resize(size_t(image_buffer->width()) * image_buffer->height());
 
     auto worker = [&]() {
 
@@ -143,8 +477,10 @@ int render::mtpool_bucket_prog_render() {
 
             int completed = buckets_completed.fetch_add(1) + 1;
             int current_progress = completed * total_samples / total_buckets;
-            progress_bar.update(current_progress);
-            updateProgress(current_progress, sqrt_spp * sqrt_spp);
+            if (progress_bar) {
+                progress_bar->update(current_progress);
+                updateProgress(current_progress, samples_per_pixel);
+            }
         }
     };
 
@@ -157,12 +493,6 @@ int render::mtpool_bucket_prog_render() {
     for (auto& thread : threads) {
         thread.join();
     }
-
-    std::cout << std::endl;
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
-    std::cout << "Rendering time: " << duration.count() << " seconds" << std::endl;
-    return duration.count();
 }
 void render::set_render_buffer(ImageSPD * buffer){
     image_buffer->load_from_spd_image(buffer);
@@ -184,9 +514,6 @@ void render::initialize(bool is_vertical_fov, bool fov_in_degrees) {
     }
 
 
-    sqrt_spp = int(std::sqrt(samples_per_pixel));
-    pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
-    recip_sqrt_spp = 1.0 / sqrt_spp;
 
     // Calculate the u,v,w unit basis vectors for the camera coordinate frame.
     w = unit_vector(camera.center - camera.look_at);
@@ -205,15 +532,24 @@ void render::initialize(bool is_vertical_fov, bool fov_in_degrees) {
     auto viewport_upper_left = camera.center - (focal_length * w) - viewport_u/2 - viewport_v/2;
     pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
 
+    // Cache cells are sized by their distance to the camera
+    if (fast_cache)
+        fast_cache->set_camera(camera.center);
+
 
 }
-ray render::get_ray(int i, int j, int s_i, int s_j, int depth) const {
+ray render::get_ray(int i, int j, int s, int depth, double * weight) const {
     // Construct a camera ray originating from the origin and directed at randomly sampled
     // point around the pixel location i, j.
 
 
-    auto offset = sample_square_stratified(s_i, s_j);
-    //vec3 offset = dithering.sample_square_dithered(s_i, s_j, i, j, sqrt_spp);
+    // The stratified sample is warped to the reconstruction filter, whose
+    // sign becomes the weight of the sample
+    vec3 u = sample_pixel(i, j, s);
+    double filter_weight;
+    vec3 offset = filter->sample(u.x(), u.y(), filter_weight);
+    if (weight)
+        *weight = filter_weight;
     auto pixel_sample = pixel00_loc
                         + ((i + offset.x()) * pixel_delta_u)
                         + ((j + offset.y()) * pixel_delta_v);
@@ -223,74 +559,408 @@ ray render::get_ray(int i, int j, int s_i, int s_j, int depth) const {
 
     return ray(ray_origin, ray_direction, depth);
 }
-vec3 render::sample_square_stratified(int s_i, int s_j) const {
-
-    auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-    auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
-
-    return vec3(px, py, 0);
+vec3 render::sample_pixel(int i, int j, int s) const {
+    // Correlated multi-jittered pattern, stratified for any sample count. Each
+    // pixel and pass gets its own pattern, except with blue noise where all
+    // pixels share one and are told apart by the tile offset instead.
+    uint32_t pattern = uint32_t(pass_index) * 83492791u;
+    if (!blue_noise)
+        pattern ^= uint32_t(i) * 73856093u ^ uint32_t(j) * 19349663u;
+    vec3 u = cmj_sample(s, samples_per_pixel, pattern);
+    if (blue_noise)
+        u = blue_noise->sample_square_dithered(u, i, j, pass_index);
+    return u;
 }
 void render::process_bucket(const Bucket& bucket) {
+    // Resampled direct lighting needs emitters to sample and full spectra to weight them
+    if (restir_direct && !fast_render && full_spectrum_sampling && !light_sampler->empty()) {
+        process_bucket_restir(bucket);
+        emit_bucket(bucket);
+        return;
+    }
+
     const int PACKET_SIZE = 4; // Process 4 rays at a time
-    const int total_samples = sqrt_spp * sqrt_spp;
+    const int total_samples = samples_per_pixel;
     for (int j = bucket.start_y; j < bucket.end_y; j += PACKET_SIZE) {
         for (int i = bucket.start_x; i < bucket.end_x; i += PACKET_SIZE) {
             if(i < region_x || i >= region_x + region_width || j < region_y || j >= region_y + region_height) {
                 continue;
             }
             std::array<spectrum, PACKET_SIZE * PACKET_SIZE> pixel_colors;
-            pixel_colors.fill( spectrum(color(0, 0, 0)));
+            pixel_colors.fill(spectrum());
+            std::array<double, PACKET_SIZE * PACKET_SIZE> pixel_weights;
+            pixel_weights.fill(0.0);
 
             for (int s = 0; s < total_samples; ++s) {
-                int s_i = s % sqrt_spp;
-                int s_j = s / sqrt_spp;
-
                 std::array<ray, PACKET_SIZE * PACKET_SIZE> rays;
+                std::array<double, PACKET_SIZE * PACKET_SIZE> weights;
+                weights.fill(0.0);
                 for (int pj = 0; pj < PACKET_SIZE && j + pj < bucket.end_y; ++pj) {
                     for (int pi = 0; pi < PACKET_SIZE && i + pi < bucket.end_x; ++pi) {
-                        rays[pj * PACKET_SIZE + pi] = get_ray(i + pi, j + pj, s_i, s_j, 0);
+                        rays[pj * PACKET_SIZE + pi] = get_ray(i + pi, j + pj, s, 0, &weights[pj * PACKET_SIZE + pi]);
                     }
                 }
-                for (int i = 0; i < rays.size(); ++i) {
-                    if (full_spectrum_sampling) {
-                        pixel_colors[i] += ray_color(rays[i], max_depth);
+                for (int r = 0; r < rays.size(); ++r) {
+                    int x = i + r % PACKET_SIZE;
+                    int y = j + r / PACKET_SIZE;
+                    FirstHit first;
+                    FirstHit * first_ptr = features && x < bucket.end_x && y < bucket.end_y ? &first : nullptr;
+                    spectrum sample;
+                    // The radiance cache stores whole spectra, so it is always sampled that way
+                    if (full_spectrum_sampling || (fast_render && fast_cache)) {
+                        sample = ray_color(rays[r], max_depth, true, first_ptr);
                     } else {
+                        // The first hit does not depend on the wavelength
                         for (int wl = 0; wl < spectrum::RESPONSE_SAMPLES; ++wl) {
-                            rays[i].wavelength = spectrum::START_WAVELENGTH + wl * (spectrum::END_WAVELENGTH - spectrum::START_WAVELENGTH) / (spectrum::RESPONSE_SAMPLES - 1);
-                            pixel_colors[i][wl] += ray_color(rays[i], max_depth)[wl];
+                            rays[r].wavelength = spectrum::START_WAVELENGTH + wl * (spectrum::END_WAVELENGTH - spectrum::START_WAVELENGTH) / (spectrum::RESPONSE_SAMPLES - 1);
+                            sample[wl] = ray_color(rays[r], max_depth, true, wl == 0 ? first_ptr : nullptr)[wl];
                         }
-                    } 
+                    }
+                    pixel_colors[r] += sample * weights[r];
+                    pixel_weights[r] += weights[r];
+                    if (first_ptr)
+                        gather_features(x, y, first, sample);
                 }
             }
 
             // Set pixel colors
             for (int pj = 0; pj < PACKET_SIZE && j + pj < bucket.end_y; ++pj) {
                 for (int pi = 0; pi < PACKET_SIZE && i + pi < bucket.end_x; ++pi) {
-                    image_buffer->set_pixel(i + pi, j + pj, pixel_colors[pj * PACKET_SIZE + pi] * pixel_samples_scale);
+                    double weight_sum = pixel_weights[pj * PACKET_SIZE + pi];
+                    image_buffer->set_pixel(i + pi, j + pj, weight_sum > 0 ? pixel_colors[pj * PACKET_SIZE + pi] / weight_sum : spectrum());
+                }
+            }
+        }
+    }
+    emit_bucket(bucket);
+}
+void render::process_bucket_restir(const Bucket& bucket) {
+    const int width = bucket.end_x - bucket.start_x;
+    const int height = bucket.end_y - bucket.start_y;
+    const int total_samples = samples_per_pixel;
+    std::vector<ReSTIRPixel> current(width * height);
+    std::vector<spectrum> pixel_colors(width * height, spectrum());
+    std::vector<spectrum> sample_colors(width * height);
+    std::vector<FirstHit> first_hits(features ? width * height : 0);
+    std::vector<double> sample_weights(width * height, 0.0);
+    std::vector<double> pixel_weights(width * height, 0.0);
+
+    auto in_region = [&](int x, int y) {
+        return x >= region_x && x < region_x + region_width && y >= region_y && y < region_y + region_height;
+    };
+
+    // Reservoirs of the last sample of each pixel outlive the bucket, so
+    // later passes and progressive UI renders pick up where this one stopped
+    const int image_width = image_buffer->width();
+    auto history = [&](int pi, int pj) -> ReSTIRHistory& {
+        return restir_history[size_t(bucket.start_y + pj) * image_width + bucket.start_x + pi];
+    };
+
+    // Passes run sample by sample over the whole bucket so each pass can reuse
+    // the reservoirs of the previous pass and of neighbouring pixels.
+    for (int s = 0; s < total_samples; ++s) {
+        // Primary hits, initial candidates and temporal reuse
+        for (int pj = 0; pj < height; ++pj) {
+            for (int pi = 0; pi < width; ++pi) {
+                int index = pj * width + pi;
+                ReSTIRPixel& pixel = current[index];
+                pixel = ReSTIRPixel();
+                if (!in_region(bucket.start_x + pi, bucket.start_y + pj))
+                    continue;
+
+                ray primary = get_ray(bucket.start_x + pi, bucket.start_y + pj, s, 0, &sample_weights[index]);
+                if (features)
+                    first_hits[index] = FirstHit();
+                sample_colors[index] = restir_primary(primary, pixel, features ? &first_hits[index] : nullptr);
+                if (!pixel.valid)
+                    continue;
+
+                const ReSTIRHistory& stored = history(pi, pj);
+                if (!stored.valid())
+                    continue;
+                ReSTIRPixel restored = restir_restore(stored);
+                const ReSTIRPixel* previous = &restored;
+                restir_combine(pixel, &previous, 1);
+            }
+        }
+
+        // Spatial reuse reads the temporal results and writes into a separate buffer
+        std::vector<ReSTIRPixel> spatial = current;
+        for (int pj = 0; pj < height; ++pj) {
+            for (int pi = 0; pi < width; ++pi) {
+                int index = pj * width + pi;
+                ReSTIRPixel& pixel = spatial[index];
+                if (!pixel.valid)
+                    continue;
+
+                const ReSTIRPixel* sources[RESTIR_SPATIAL_NEIGHBOURS];
+                int source_count = 0;
+                for (int n = 0; n < RESTIR_SPATIAL_NEIGHBOURS; ++n) {
+                    int nx = pi + random_int(-RESTIR_SPATIAL_RADIUS, RESTIR_SPATIAL_RADIUS);
+                    int ny = pj + random_int(-RESTIR_SPATIAL_RADIUS, RESTIR_SPATIAL_RADIUS);
+                    if (nx < 0 || nx >= width || ny < 0 || ny >= height || (nx == pi && ny == pj))
+                        continue;
+                    const ReSTIRPixel& neighbour = current[ny * width + nx];
+                    if (!neighbour.valid || neighbour.reservoir.W <= 0)
+                        continue;
+                    // Only reuse from the same surface
+                    if (dot(neighbour.rec.normal, pixel.rec.normal) < 0.9 ||
+                        std::fabs(neighbour.rec.t - pixel.rec.t) > 0.1 * pixel.rec.t)
+                        continue;
+                    sources[source_count++] = &neighbour;
+                }
+                restir_combine(pixel, sources, source_count);
+
+                // Shade with the surviving sample, re-checking its visibility
+                Reservoir& reservoir = pixel.reservoir;
+                if (reservoir.W > 0 && restir_visible(pixel.rec.p, reservoir.y)) {
+                    double target;
+                    sample_colors[index] += restir_unshadowed(pixel, reservoir.light, reservoir.y, target) * reservoir.W;
+                } else {
+                    reservoir.W = 0.0;
                 }
             }
         }
+        for (int pj = 0; pj < height; ++pj)
+            for (int pi = 0; pi < width; ++pi)
+                if (in_region(bucket.start_x + pi, bucket.start_y + pj))
+                    history(pi, pj) = ReSTIRHistory(spatial[pj * width + pi]);
+
+        for (int pj = 0; pj < height; ++pj) {
+            for (int pi = 0; pi < width; ++pi) {
+                int index = pj * width + pi;
+                if (!in_region(bucket.start_x + pi, bucket.start_y + pj))
+                    continue;
+                pixel_colors[index] += sample_colors[index] * sample_weights[index];
+                pixel_weights[index] += sample_weights[index];
+                if (features)
+                    gather_features(bucket.start_x + pi, bucket.start_y + pj, first_hits[index], sample_colors[index]);
+            }
+        }
+    }
+
+    for (int pj = 0; pj < height; ++pj) {
+        for (int pi = 0; pi < width; ++pi) {
+            if (in_region(bucket.start_x + pi, bucket.start_y + pj))
+                image_buffer->set_pixel(bucket.start_x + pi, bucket.start_y + pj, pixel_weights[pj * width + pi] > 0 ? pixel_colors[pj * width + pi] / pixel_weights[pj * width + pi] : spectrum());
+        }
+    }
+}
+spectrum render::restir_primary(const ray& r, ReSTIRPixel& pixel, FirstHit * first) const {
+    pixel.valid = false;
+
+    hit_record rec;
+    ray current = r;
+    while (true) {
+        if (!world->hit(current, interval(0.001, infinity), rec))
+            return background_color;
+        if (rec.mat->is_visible())
+            break;
+        const double bias = 0.0001;
+        current = ray(rec.p + bias * current.direction(), current.direction(), current.get_depth());
+    }
+    if (first)
+        first->set(current, rec);
+
+    scatter_record srec;
+    spectrum color_from_emission = rec.mat->emitted(current, rec, rec.u, rec.v, rec.p);
+
+    if (!rec.mat->scatter(current, rec, srec))
+        return color_from_emission;
+
+    // Specular lobes keep going through the regular path tracer
+    if (srec.skip_pdf) {
+        srec.skip_pdf_ray.path_flags = PATH_SPECULAR;
+        return srec.attenuation * ray_color(srec.skip_pdf_ray, max_depth - 1) + color_from_emission;
+    }
+    // and so do glossy ones, after one sample of their own pdf
+    if (srec.lobe != LOBE_DIFFUSE) {
+        ray scattered = ray(rec.p, srec.pdf_ptr->generate(), current.get_depth() + 1);
+        scattered.path_flags = PATH_SPECULAR;
+        double pdf_val = srec.pdf_ptr->value(scattered.direction());
+        delete srec.pdf_ptr;
+        if (pdf_val <= 0)
+            return color_from_emission;
+        double scattering_pdf = rec.mat->scattering_pdf(current, rec, scattered, srec.lobe);
+        return srec.attenuation * scattering_pdf * ray_color(scattered, max_depth - 1) / pdf_val + color_from_emission;
+    }
+
+    bool gather_caustics = caustics && !caustics->empty();
+    if (gather_caustics)
+        color_from_emission += srec.attenuation * caustics->irradiance(rec.p, rec.normal) / pi;
+
+    // Indirect light from BSDF samples. Emission at the next vertex is direct
+    // light and is left to the reservoirs. Split like the first diffuse vertex in ray_color.
+    spectrum color_from_scatter;
+    for (int k = 0; k < path_splits; ++k) {
+        ray scattered = ray(rec.p, srec.pdf_ptr->generate(), current.get_depth() + 1);
+        scattered.path_flags = PATH_DIFFUSE | (gather_caustics ? PATH_CAUSTIC : 0);
+        double pdf_val = srec.pdf_ptr->value(scattered.direction());
+        if (pdf_val > 0) {
+            double scattering_pdf = rec.mat->scattering_pdf(current, rec, scattered);
+            color_from_scatter += (srec.attenuation * scattering_pdf * ray_color(scattered, max_depth - 1, false)) / pdf_val;
+        }
+    }
+    color_from_scatter /= path_splits;
+    delete srec.pdf_ptr;
+
+    pixel.valid = true;
+    pixel.r_in = current;
+    pixel.rec = rec;
+    pixel.attenuation = srec.attenuation;
+
+    // Initial candidates from the light BVH, converted to area measure
+    Reservoir& reservoir = pixel.reservoir;
+    reservoir = Reservoir();
+    for (int c = 0; c < RESTIR_CANDIDATES; ++c) {
+        double pmf;
+        int light_index = light_sampler->sample_light(rec.p, random_double(), pmf);
+        hit_record light_rec;
+        if (light_index < 0 || pmf <= 0) {
+            reservoir.M += 1;
+            continue;
+        }
+        hittable * light = light_sampler->get_light(light_index);
+        vec3 direction = light->random(rec.p);
+        if (!light->hit(ray(rec.p, direction), interval(0.001, infinity), light_rec)) {
+            reservoir.M += 1;
+            continue;
+        }
+        double distance_squared = (light_rec.p - rec.p).length_squared();
+        double cosine = std::fabs(dot(light_rec.normal, unit_vector(direction)));
+        double pdf_area = pmf * light->pdf_value(rec.p, direction) * cosine / distance_squared;
+
+        double target;
+        restir_unshadowed(pixel, light, light_rec.p, target);
+        reservoir.update(light, light_rec.p, pdf_area > 0 ? target / pdf_area : 0.0, target);
+    }
+    reservoir.W = reservoir.p_hat > 0 ? reservoir.w_sum / (reservoir.M * reservoir.p_hat) : 0.0;
+
+    // Occluded samples are dropped before they can be reused
+    if (reservoir.W > 0 && !restir_visible(rec.p, reservoir.y))
+        reservoir.W = 0.0;
+
+    return color_from_emission + color_from_scatter;
+}
+ReSTIRPixel render::restir_restore(const ReSTIRHistory& history) const {
+    ReSTIRPixel pixel;
+    pixel.valid = true;
+    pixel.r_in = ray(history.p - history.direction, history.direction);
+    pixel.rec.p = history.p;
+    pixel.rec.normal = history.normal;
+    pixel.rec.front_face = true;
+    pixel.rec.mat = history.mat;
+    pixel.rec.t = 1.0;
+    pixel.rec.u = pixel.rec.v = 0.0;
+    pixel.reservoir = history.reservoir;
+
+    // The attenuation only decides whether the stored surface could have
+    // produced a sample, so texture coordinates are not kept for it
+    scatter_record srec;
+    if (history.mat->scatter(pixel.r_in, pixel.rec, srec)) {
+        pixel.attenuation = srec.attenuation;
+        delete srec.pdf_ptr;
+    }
+    return pixel;
+}
+spectrum render::restir_unshadowed(const ReSTIRPixel& pixel, hittable * light, const point3& y, double& target) const {
+    target = 0.0;
+    vec3 direction = y - pixel.rec.p;
+    double distance_squared = direction.length_squared();
+    if (distance_squared <= 0)
+        return spectrum();
+
+    // y lies at t = 1 along the unnormalised direction
+    ray to_light(pixel.rec.p, direction, pixel.r_in.get_depth() + 1);
+    hit_record light_rec;
+    if (!light->hit(to_light, interval(1.0 - 1e-4, 1.0 + 1e-4), light_rec))
+        return spectrum();
+
+    double bsdf = pixel.rec.mat->scattering_pdf(pixel.r_in, pixel.rec, to_light);
+    if (bsdf <= 0)
+        return spectrum();
+
+    double cosine = std::fabs(dot(light_rec.normal, direction)) / std::sqrt(distance_squared);
+    spectrum emission = light_rec.mat->emitted(to_light, light_rec, light_rec.u, light_rec.v, light_rec.p);
+    spectrum contribution = pixel.attenuation * emission * (bsdf * cosine / distance_squared);
+    target = std::max(0.0, contribution.average());
+    return contribution;
+}
+bool render::restir_visible(const point3& x, const point3& y) const {
+    hit_record rec;
+    ray shadow(x, y - x);
+    // Stop just short of y so the light itself does not occlude its own sample
+    interval shadow_t(0.001, 1.0 - 1e-4);
+    while (world->hit(shadow, shadow_t, rec)) {
+        if (rec.mat->is_visible())
+            return false;
+        shadow_t.min = rec.t + 1e-4;
+    }
+    return true;
+}
+void render::restir_combine(ReSTIRPixel& pixel, const ReSTIRPixel* const* sources, int count) const {
+    if (count == 0)
+        return;
+
+    const double history_cap = RESTIR_HISTORY_CAP * RESTIR_CANDIDATES;
+    const Reservoir& own = pixel.reservoir;
+    Reservoir combined;
+    combined.update(own.light, own.y, own.p_hat * own.W * own.M, own.p_hat, own.M);
+    for (int i = 0; i < count; ++i) {
+        const Reservoir& r = sources[i]->reservoir;
+        double M = std::min(r.M, history_cap);
+        double target = 0.0;
+        if (r.light && r.W > 0)
+            restir_unshadowed(pixel, r.light, r.y, target);
+        combined.update(r.light, r.y, target * r.W * M, target, M);
     }
-    ImageSPD * bucket_image = new ImageSPD(bucket.end_x - bucket.start_x, bucket.end_y - bucket.start_y, spectrum::RESPONSE_SAMPLES, observer_ptr);
+
+    // Normalise only by the reservoirs that could have produced the chosen
+    // sample, which keeps the combination unbiased across different surfaces.
+    double Z = 0.0;
+    if (combined.light && combined.p_hat > 0) {
+        Z += own.M;
+        for (int i = 0; i < count; ++i) {
+            double target;
+            restir_unshadowed(*sources[i], combined.light, combined.y, target);
+            if (target > 0)
+                Z += std::min(sources[i]->reservoir.M, history_cap);
+        }
+    }
+    combined.W = (Z > 0 && combined.p_hat > 0) ? combined.w_sum / (Z * combined.p_hat) : 0.0;
+    combined.M = std::min(combined.M, history_cap);
+    pixel.reservoir = combined;
+}
+void render::emit_bucket(const Bucket& bucket) {
+    ImageSPD * bucket_image = new ImageSPD(bucket.end_x - bucket.start_x, bucket.end_y - bucket.start_y, spectrum::RESPONSE_SAMPLES, observer_ptr, film, film_basis);
     for (int pj = 0; pj < bucket.end_y - bucket.start_y; ++pj) {
         for (int pi = 0; pi < bucket.end_x - bucket.start_x; ++pi) { 
-            bucket_image->set_pixel(pi, pj, image_buffer->get_pixel(bucket.start_x + pi, bucket.start_y + pj));
+            bucket_image->copy_pixel(pi, pj, *image_buffer, bucket.start_x + pi, bucket.start_y + pj);
         }
     }
     emit bucketFinished(bucket.start_x, bucket.start_y, bucket_image);
 }
+void render::gather_features(int x, int y, const FirstHit& hit, const spectrum& sample) {
+    features->add_sample(x, y, hit.albedo, hit.normal, hit.depth, sample.average());
+}
 void render::updateProgress(int current, int total) {
     emit progressUpdated(current, total);
 }
-spectrum render::ray_color(const ray& r, int depth) const {
+spectrum render::ray_color(const ray& r, int depth, bool count_emission, FirstHit * first) const {
     if (depth <= 0)
-        return color(0,0,0);
+        return spectrum();
 
     hit_record rec;
     if (!world->hit(r, interval(0.001, infinity), rec))
         return background_color;
 
     if(fast_render){
+        if (fast_cache)
+            return cached_ray_color(r, rec, std::min(depth, RADIANCE_CACHE_DEPTH), true, first);
+        // Without the cache the first hit is shaded even when invisible,
+        // so the features describe that surface too
+        if (first)
+            first->set(r, rec);
         return rec.mat->fast_ray_color(r, rec, rec.u, rec.v, rec.p);
     }
 
@@ -298,30 +968,131 @@ spectrum render::ray_color(const ray& r, int depth) const {
     if (!rec.mat->is_visible()) {
         const double bias = 0.0001;
         ray continued_ray(rec.p + bias * r.direction(), r.direction(), r.get_depth());
-        return ray_color(continued_ray, depth);
+        continued_ray.path_flags = r.path_flags;
+        return ray_color(continued_ray, depth, count_emission, first);
     }
+    if (first)
+        first->set(r, rec);
+
+    // Light reaching the last diffuse vertex through specular bounces was
+    // already gathered from the photon map there
+    bool use_photons = caustics && !caustics->empty();
+    bool is_caustic = use_photons && (r.path_flags & PATH_CAUSTIC) && (r.path_flags & PATH_SPECULAR);
 
     scatter_record srec;
-    spectrum color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+    spectrum color_from_emission = count_emission && !is_caustic ? rec.mat->emitted(r, rec, rec.u, rec.v, rec.p) : spectrum();
 
     if (!rec.mat->scatter(r, rec, srec))
         return color_from_emission;
 
     if (srec.skip_pdf) {
+        srec.skip_pdf_ray.path_flags = r.path_flags | PATH_SPECULAR;
         return srec.attenuation * ray_color(srec.skip_pdf_ray, depth-1) + color_from_emission;
     }
 
-    auto light_ptr = new hittable_pdf(lights, rec.p);
-    mixture_pdf p(light_ptr, srec.pdf_ptr);
+    // Glossy lobes are sampled through their pdf but continue the path as a
+    // specular bounce, so caustics seen through them still come from the photon map
+    bool diffuse = srec.lobe == LOBE_DIFFUSE;
 
-    ray scattered = ray(rec.p, p.generate(), r.get_depth() + 1);
-    auto pdf_val = p.value(scattered.direction());
+    // The first diffuse vertex of a camera path takes its caustics from the photon map
+    bool gather_caustics = diffuse && use_photons && !(r.path_flags & PATH_DIFFUSE);
+    if (gather_caustics)
+        color_from_emission += srec.attenuation * caustics->irradiance(rec.p, rec.normal) / pi;
 
-    double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+    // Where the path guiding tree has learnt something, the BSDF pdf is mixed
+    // with the guiding distribution through one-sample MIS.
+    const dtree * guide = guiding && diffuse ? guiding->sampling_tree(rec.p) : nullptr;
+    guided_pdf guide_pdf(guide);
+    mixture_pdf guided_mixture(srec.pdf_ptr, &guide_pdf, guiding_bsdf_fraction);
+    pdf * surface_pdf = guide ? static_cast<pdf*>(&guided_mixture) : srec.pdf_ptr;
 
-    spectrum color_from_scatter = (srec.attenuation * scattering_pdf * ray_color(scattered, depth-1)) / pdf_val;
+    // Mix light sampling through the light BVH with the surface pdf. Without any
+    // emitters there is nothing to sample, so only the surface pdf is used.
+    // Lights are rarely behind a refracting surface, so transmission skips them.
+    hittable_pdf light_pdf(light_sampler, rec.p);
+    mixture_pdf mixed_pdf(&light_pdf, surface_pdf);
+    bool sample_lights = !light_sampler->empty() && srec.lobe != LOBE_GLOSSY_TRANSMISSION;
+    pdf * p = sample_lights ? static_cast<pdf*>(&mixed_pdf) : surface_pdf;
 
-    return color_from_emission + color_from_scatter;
+    // The first diffuse vertex of a camera path is split into several
+    // secondary paths, which share the cost of the camera ray and primary hit
+    int splits = diffuse && !(r.path_flags & PATH_DIFFUSE) ? path_splits : 1;
+    int next_flags = diffuse ? PATH_DIFFUSE | (gather_caustics ? PATH_CAUSTIC : 0) : r.path_flags | PATH_SPECULAR;
+    spectrum color_from_scatter;
+    for (int k = 0; k < splits; ++k) {
+        ray scattered = ray(rec.p, p->generate(), r.get_depth() + 1);
+        scattered.path_flags = next_flags;
+        auto pdf_val = p->value(scattered.direction());
+        if (pdf_val <= 0)
+            continue;
+
+        double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered, srec.lobe);
+
+        spectrum incoming = ray_color(scattered, depth-1);
+        if (guiding && guiding->is_training())
+            guiding->record(rec.p, scattered.direction(), float(incoming.average() / pdf_val));
+
+        color_from_scatter += (srec.attenuation * scattering_pdf * incoming) / pdf_val;
+    }
+    delete srec.pdf_ptr;
+
+    return color_from_emission + color_from_scatter / splits;
+}
+spectrum render::cached_ray_color(const ray& r, const hit_record& hit, int depth, bool primary, FirstHit * first) const {
+    // Short paths whose tail is read from the radiance cache. Every vertex adds
+    // its estimate back, so over successive Fast renders the cache picks up
+    // more and more bounces while each frame only traces a few.
+    hit_record rec = hit;
+    ray current = r;
+    while (!rec.mat->is_visible()) {
+        const double bias = 0.0001;
+        current = ray(rec.p + bias * current.direction(), current.direction(), current.get_depth());
+        if (!world->hit(current, interval(0.001, infinity), rec))
+            return background_color;
+    }
+    if (first)
+        first->set(current, rec);
+
+    // Camera hits are always traced, so shadows and contact detail stay sharp
+    spectrum cached;
+    bool has_cached = fast_cache->lookup(rec.p, rec.normal, cached);
+    if (!primary && has_cached)
+        return cached;
+
+    spectrum radiance = rec.mat->emitted(current, rec, rec.u, rec.v, rec.p);
+    // A path cut off by the depth limit has no bounce light yet. Cached, it
+    // would darken the cell for every later lookup, so only vertices that
+    // scattered or cannot scatter add their estimate.
+    if (depth <= 1)
+        return radiance;
+    scatter_record srec;
+    if (!rec.mat->scatter(current, rec, srec)) {
+        fast_cache->add(rec.p, rec.normal, radiance);
+        return radiance;
+    }
+
+    ray scattered;
+    double weight = 1.0;
+    if (srec.skip_pdf) {
+        scattered = srec.skip_pdf_ray;
+    } else {
+        hittable_pdf light_pdf(light_sampler, rec.p);
+        mixture_pdf mixed_pdf(&light_pdf, srec.pdf_ptr);
+        bool sample_lights = !light_sampler->empty() && srec.lobe != LOBE_GLOSSY_TRANSMISSION;
+        pdf * p = sample_lights ? static_cast<pdf*>(&mixed_pdf) : srec.pdf_ptr;
+        scattered = ray(rec.p, p->generate(), current.get_depth() + 1);
+        double pdf_val = p->value(scattered.direction());
+        weight = pdf_val > 0 ? rec.mat->scattering_pdf(current, rec, scattered, srec.lobe) / pdf_val : 0.0;
+        delete srec.pdf_ptr;
+    }
+
+    if (weight > 0) {
+        hit_record next;
+        spectrum incoming = world->hit(scattered, interval(0.001, infinity), next) ? cached_ray_color(scattered, next, depth - 1, false) : spectrum(background_color);
+        radiance += srec.attenuation * incoming * weight;
+    }
+    fast_cache->add(rec.p, rec.normal, radiance);
+    return radiance;
 }
 void render::lightsource_override(int index){
     for(const auto& light : *lights->objects){
@@ -340,6 +1111,10 @@ void render::lightsource_override(int index){
                 area_light->set_emission(spectrum::d50_cb());
         }
     }
+    // The light BVH and radiance cache follow at the start of the next
+    // render, and reservoirs weighted by the old emission are dropped
+    lights_changed = true;
+    restir_reset = true;
     for(const auto& material : all_materials){
         if(index == 0)
             material->set_fast_light_color(spectrum::d65());
@@ -356,12 +1131,15 @@ void render::lightsource_override(int index){
     }
 }
 void render::render_mode_changed(int index){
+    bool was_fast_render = fast_render;
     fast_render = index == 1;
+    restir_direct = index == 2;
+    restir_reset = true;
     if(fast_render){
         saved_samples_per_pixel = samples_per_pixel;
-        samples_changed(16);
-        emit samples_changed_internal(16);
-    } else {
+        samples_changed(settings_ptr->fast_samples);
+        emit samples_changed_internal(settings_ptr->fast_samples);
+    } else if(was_fast_render) {
         samples_changed(saved_samples_per_pixel);
         emit samples_changed_internal(saved_samples_per_pixel);
     }
@@ -371,7 +1149,8 @@ void render::samples_changed(int samples){
     initialize();
 }
 void render::resolution_changed(int width, int height){
-    image_buffer = new ImageSPD(width, height, spectrum::RESPONSE_SAMPLES, observer_ptr);
+    image_buffer = new ImageSPD(width, height, spectrum::RESPONSE_SAMPLES, observer_ptr, film, film_basis);
+    restir_reset = true;
     initialize();
 }
 void render::spectrum_sampling_changed(int index){
@@ -386,16 +1165,12 @@ void render::render_region_changed(int x, int y, int width, int height){
 }
     // Internal
 void render::load_lookup_table() {
-    std::vector<std::vector<std::vector<vec3>>> lookup_table;
-    std::ifstream file("lookup_table.bin", std::ios::binary);
+    std::vector<std::string> directories = spectral_lut::search_path(settings_ptr->lut_path);
+    if (spectral_lut::load(directories, 0.01f))
+        return;
 
-    if (file.good()) {
-        std::cout << "Loading existing lookup table..." << std::endl;
-        lookup_table = spectrum::load_lookup_tables(0.01);
-        spectrum::setLookupTable(lookup_table, 0.01);
-    } else {
-        std::cout << "Lookup table not found. Computing new lookup table..." << std::endl;
-        spectrum::compute_lookup_tables(0.01);
-
-    }
+    std::cout << "Lookup table not found. Computing new lookup table..." << std::endl;
+    std::vector<vec3> lookup_table = spectral_fit::compute_table(0.01f);
+    spectrum::setLookupTable(lookup_table, 0.01);
+    spectral_lut::save(directories, lookup_table, 0.01f);
 }
\ No newline at end of file
@@ -10,9 +10,16 @@
 
 #include "data/hittable_list.h"
 #include "data/bvh.h"
+#include "data/light_bvh.h"
+#include "data/sd_tree.h"
+#include "data/photon_map.h"
+#include "data/radiance_cache.h"
 
 
 #include "image/image_spd.h"
+#include "data/spectral_lut.h"
+#include "data/spectral_fit.h"
+#include "image/denoiser.h"
 #include "helpers/settings.h"
 
 #include "usd/light.h"
@@ -22,6 +29,9 @@
 #include "usd/loader.h"
 
 #include "helpers/strings.h"
+#include "helpers/dithering.h"
+#include "helpers/filter.h"
+#include "helpers/sampler.h"
 #include <thread>
 
 #include <QObject>
@@ -42,7 +52,8 @@ public:
     
     void update(int current) {
         int last = last_printed.load();
-        if (current - last > total / 100) {  // Update every 1% progress
+        // Update every 1% progress, and once more on reaching the total
+        if (current - last > total / 100 || (current >= total && last < total)) {
             if (last_printed.compare_exchange_strong(last, current)) {
                 print(current);
             }
@@ -72,6 +83,87 @@ struct Bucket {
     int start_x, start_y, end_x, end_y;
 };
 
+// Resampled direct lighting (ReSTIR)
+const int RESTIR_CANDIDATES = 8;        // Initial light candidates per pixel and pass
+const int RESTIR_SPATIAL_NEIGHBOURS = 3;
+const int RESTIR_SPATIAL_RADIUS = 4;    // In pixels, neighbours are taken from the same bucket
+const int RESTIR_HISTORY_CAP = 20;      // Temporal history is capped at this many times the candidate count
+
+// Progressive photon mapping, the squared gather radius shrinks by (i + alpha) / (i + 1) per pass
+const double PHOTON_RADIUS_ALPHA = 2.0 / 3.0;
+
+// Upper bound on progressive passes when rendering to a time or noise budget
+const int MAX_PROGRESSIVE_PASSES = 4096;
+// Steps of the progress bar of a budgeted render, which counts the spent budget
+// rather than samples
+const int BUDGET_PROGRESS_STEPS = 1000;
+
+// Vertices traced per Fast mode path before the radiance cache takes over
+const int RADIANCE_CACHE_DEPTH = 3;
+
+// Reservoir holding one light sample. The sample is a point on a light,
+// so all weights are in area measure and can be reused between pixels.
+struct Reservoir {
+    hittable * light = nullptr;
+    point3 y;
+    double w_sum = 0.0;
+    double M = 0.0;
+    double W = 0.0;
+    double p_hat = 0.0;
+
+    bool update(hittable * candidate, const point3& point, double weight, double target, double count = 1.0) {
+        w_sum += weight;
+        M += count;
+        if (weight > 0 && random_double() * w_sum < weight) {
+            light = candidate;
+            y = point;
+            p_hat = target;
+            return true;
+        }
+        return false;
+    }
+};
+
+// Primary shading point of a pixel for the current pass together with its reservoir
+struct ReSTIRPixel {
+    bool valid = false;
+    ray r_in;
+    hit_record rec;
+    spectrum attenuation;
+    Reservoir reservoir;
+};
+
+// What restir_history keeps of a ReSTIRPixel between passes: the reservoir
+// and the shading point it was weighted at, without the ray, hit record and
+// attenuation spectrum, which restir_restore rebuilds when the entry is reused
+struct ReSTIRHistory {
+    Reservoir reservoir;
+    point3 p;
+    vec3 normal;
+    vec3 direction;     // of the ray arriving at p
+    rd::core::material * mat = nullptr;
+
+    ReSTIRHistory() = default;
+    explicit ReSTIRHistory(const ReSTIRPixel& pixel)
+        : reservoir(pixel.reservoir), p(pixel.rec.p), normal(pixel.rec.normal), direction(pixel.r_in.direction()),
+          mat(pixel.valid ? pixel.rec.mat : nullptr) {}
+    bool valid() const { return mat != nullptr; }
+};
+
+// First visible surface of a camera ray, kept for the denoiser features so
+// they need no second trace. Rays that leave the scene keep the defaults.
+struct FirstHit {
+    spectrum albedo;
+    vec3 normal = vec3(0, 0, 0);
+    double depth = 0.0;
+
+    void set(const ray& r, const hit_record& rec) {
+        albedo = rec.mat->get_albedo();
+        normal = rec.normal;
+        depth = rec.t * r.direction().length();
+    }
+};
+
 class render : public QObject{
     Q_OBJECT
 public:
@@ -100,14 +192,49 @@ signals:
 
 private:
     bool fast_render = false;
+    bool restir_direct = false;
+    // Set by the UI when emitters change. The light BVH and the radiance
+    // cache are rebuilt at the start of the next render, as a render in
+    // flight is still reading them.
+    std::atomic<bool> lights_changed{false};
+    // Final reservoir of every pixel, reused by the next pass over it.
+    // Cleared when the resolution, lights or render mode change, through
+    // restir_reset as workers may still be writing to it.
+    std::vector<ReSTIRHistory> restir_history;
+    std::atomic<bool> restir_reset{false};
+    // Secondary paths traced from the first diffuse vertex of each camera path
+    int path_splits = 1;
     hittable_list * world;
     hittable_list * lights;
+    light_bvh * light_sampler;
+    sd_tree * guiding = nullptr;
+    // Probability of sampling the BSDF instead of the guiding distribution
+    double guiding_bsdf_fraction = 0.5;
+    // Caustics from lights through specular surfaces, null unless photon mapping is enabled
+    photon_map * caustics = nullptr;
+    double photon_radius = 0.0;
+    // Radiance cache for global illumination in the Fast mode, null when disabled
+    radiance_cache * fast_cache = nullptr;
+    pixel_filter * filter;
+    // Blue noise tile for pixel sampling, null when samples are jittered randomly
+    dithering * blue_noise = nullptr;
+    // Index of the current progressive pass, decorrelates the blue noise between passes
+    int pass_index = 0;
+    // First hit features for the denoiser, only allocated when denoising
+    FeatureBuffer * features = nullptr;
     rd::usd::loader * loader;
     std::vector<rd::core::material*> all_materials;
     ImageSPD * image_buffer;
-    observer * observer_ptr ;
+    // Storage of image_buffer, XYZ when no SPD file is written
+    Image::Film film = Image::SPECTRAL;
+    // Basis of the PCA film, null for the other films
+    spectral_basis * film_basis = nullptr;
+    const observer * observer_ptr ;
     settings * settings_ptr;
     int saved_samples_per_pixel = 256;
+    // Samples per pixel of the last render, which budgeted renders only know at the end
+    int rendered_samples = 0;
+    std::chrono::high_resolution_clock::time_point render_start;
 
     int region_x = -1;  
     int region_y = -1;
@@ -119,18 +246,30 @@ private:
     vec3 pixel00_loc;
     vec3 pixel_delta_u;
     vec3 pixel_delta_v;
-    int    sqrt_spp; 
-    double recip_sqrt_spp;       
     vec3 u, v, w;              
-    color background_color = color(0.0, 0.0, 0.0) ;
-    double pixel_samples_scale;
+    // Radiance of rays leaving the scene, kept as a spectrum so misses need no uplift
+    spectrum background_color;
 
     int mtpool_bucket_prog_render();
+    void render_buckets(ProgressBar * progress_bar);
+    void train_guiding();
+    void render_passes(ProgressBar * progress_bar);
+    void trace_photons(int count, double radius);
     void initialize(bool is_vertical_fov = false, bool fov_in_degrees = true);
-    ray get_ray(int i, int j, int s_i, int s_j, int depth) const ;
-    vec3 sample_square_stratified(int s_i, int s_j) const ;
+    ray get_ray(int i, int j, int s, int depth, double * weight = nullptr) const ;
+    vec3 sample_pixel(int i, int j, int s) const ;
     void process_bucket(const Bucket& bucket) ;
-    spectrum ray_color(const ray& r, int depth) const ;
+    void process_bucket_restir(const Bucket& bucket) ;
+    void emit_bucket(const Bucket& bucket) ;
+    void gather_features(int x, int y, const FirstHit& hit, const spectrum& sample) ;
+    spectrum ray_color(const ray& r, int depth, bool count_emission = true, FirstHit * first = nullptr) const ;
+    spectrum cached_ray_color(const ray& r, const hit_record& hit, int depth, bool primary, FirstHit * first = nullptr) const ;
+
+    spectrum restir_primary(const ray& r, ReSTIRPixel& pixel, FirstHit * first = nullptr) const ;
+    ReSTIRPixel restir_restore(const ReSTIRHistory& history) const ;
+    spectrum restir_unshadowed(const ReSTIRPixel& pixel, hittable * light, const point3& y, double& target) const ;
+    bool restir_visible(const point3& x, const point3& y) const ;
+    void restir_combine(ReSTIRPixel& pixel, const ReSTIRPixel* const* sources, int count) const ;
     
     void updateProgress(int current, int total);
     void load_lookup_table();
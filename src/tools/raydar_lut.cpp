@@ -0,0 +1,148 @@
+// Generates lookup_table.bin, the RGB to spectrum coefficient table raydar
+// maps at startup, and reports how closely the fitted spectra reproduce
+// their RGB colours.
+//
+//   raydar_lut [--step 0.01] [--output dir] [--threads n] [--compare n]
+//   raydar_lut --benchmark-net spectral_net.bin [--output dir]
+
+#include "data/spectral_fit.h"
+#include "data/spectral_lut.h"
+#include "data/spectral_net.h"
+#include "helpers/cxxopts.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace {
+
+// RGB distance of the spectrum built from coeffs, through the same float
+// pipeline the renderer uses
+double round_trip_error(const observer* obs, const vec3& coeffs, const vec3& target) {
+    spectrum s(0.0f, 0.0f, 0.0f, float(coeffs.x()), float(coeffs.y()), float(coeffs.z()));
+    color rgb = s.to_rgb(obs);
+    return (vec3(rgb.x(), rgb.y(), rgb.z()) - target).length();
+}
+
+// Refits a spread of table entries with the coordinate descent solver the
+// renderer used before and compares both on them
+void compare(const std::vector<vec3>& table, float step, int count) {
+    const observer* obs = observer::get(observer::CIE1931_2Deg);
+    const int size = static_cast<int>(1.0 / step + 0.5) + 1;
+    const size_t stride = std::max<size_t>(1, table.size() / count);
+    double new_mean = 0.0, new_max = 0.0, old_mean = 0.0, old_max = 0.0, old_seconds = 0.0;
+    int compared = 0;
+
+    for (size_t i = stride / 2; i < table.size() && compared < count; i += stride, ++compared) {
+        int r_index = int(i / (size * size));
+        int g_index = int((i / size) % size);
+        int b_index = int(i % size);
+        vec3 target(std::min(r_index * step, 1.0f), std::min(g_index * step, 1.0f), std::min(b_index * step, 1.0f));
+
+        // The old solver reports every fit on stdout
+        std::ostringstream discard;
+        std::streambuf* previous = std::cout.rdbuf(discard.rdbuf());
+        auto start = std::chrono::steady_clock::now();
+        vec3 old_coeffs = spectrum::find_coeff(float(target.x()), float(target.y()), float(target.z()));
+        old_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout.rdbuf(previous);
+
+        double new_error = round_trip_error(obs, table[i], target);
+        double old_error = round_trip_error(obs, old_coeffs, target);
+        new_mean += new_error;
+        old_mean += old_error;
+        new_max = std::max(new_max, new_error);
+        old_max = std::max(old_max, old_error);
+    }
+    if (compared == 0)
+        return;
+    std::cout << "Compared " << compared << " entries with the coordinate descent solver" << std::endl;
+    std::cout << "  Levenberg-Marquardt  mean error " << new_mean / compared << ", max " << new_max << std::endl;
+    std::cout << "  Coordinate descent   mean error " << old_mean / compared << ", max " << old_max
+              << ", " << old_seconds / compared * 1000.0 << " ms per entry" << std::endl;
+}
+
+// Uplifts the same random colours through the lookup table and the
+// spectral model, timing both and measuring their RGB round-trip error
+void benchmark_net(const spectral_net& net, int count) {
+    const observer* obs = observer::get(observer::CIE1931_2Deg);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> channel(0.0f, 1.0f);
+    std::vector<color> colors(count);
+    for (color& c : colors)
+        c = color(channel(rng), channel(rng), channel(rng));
+
+    std::vector<spectrum> table_spectra(count), net_spectra(count);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+        table_spectra[i] = spectrum(colors[i]);
+    double table_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    net.to_spectra(colors.data(), count, net_spectra.data());
+    double net_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto report = [&](const char* name, const std::vector<spectrum>& spectra, double seconds) {
+        double mean = 0.0, worst = 0.0;
+        for (int i = 0; i < count; ++i) {
+            color rgb = spectra[i].to_rgb(obs);
+            double error = (vec3(rgb.x(), rgb.y(), rgb.z()) - vec3(colors[i].x(), colors[i].y(), colors[i].z())).length();
+            mean += error;
+            worst = std::max(worst, error);
+        }
+        std::cout << "  " << name << count / seconds / 1e6 << " M colours/s, RGB error mean " << mean / count << ", max " << worst << std::endl;
+    };
+    std::cout << "Uplifting " << count << " random colours" << std::endl;
+    report("Lookup table    ", table_spectra, table_seconds);
+    report("Spectral model  ", net_spectra, net_seconds);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options("raydar_lut", "Generate the RGB to spectrum lookup table");
+    options.add_options()
+        ("h,help", "Print help")
+        ("step", "Grid spacing of the table in the unit RGB cube", cxxopts::value<float>()->default_value("0.01"))
+        ("o,output", "Directory lookup_table.bin is written to", cxxopts::value<std::string>()->default_value("."))
+        ("threads", "Worker threads, 0 uses every core", cxxopts::value<int>()->default_value("0"))
+        ("compare", "Entries to refit with the previous solver for comparison", cxxopts::value<int>()->default_value("0"))
+        ("benchmark-net", "Compare a spectral model exported by assets/train_spectral.py with the table in --output", cxxopts::value<std::string>()->default_value(""));
+
+    auto result = options.parse(argc, argv);
+    if (result.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+    float step = result["step"].as<float>();
+    if (step <= 0.0f || step > 1.0f) {
+        std::cerr << "Error: Step must be in (0, 1]." << std::endl;
+        return 1;
+    }
+
+    std::string model = result["benchmark-net"].as<std::string>();
+    if (!model.empty()) {
+        spectral_net net;
+        if (!net.load(model))
+            return 1;
+        if (!spectral_lut::load(std::vector<std::string>{result["output"].as<std::string>()}, step)) {
+            std::cerr << "Error: No lookup table in " << result["output"].as<std::string>() << " to compare with." << std::endl;
+            return 1;
+        }
+        benchmark_net(net, 1 << 20);
+        return 0;
+    }
+
+    spectral_fit::statistics stats;
+    std::vector<vec3> table = spectral_fit::compute_table(step, result["threads"].as<int>(), &stats);
+    std::cout << "Fitted " << stats.entries << " entries in " << stats.seconds << " s, "
+              << stats.mean_iterations << " iterations on average" << std::endl;
+    std::cout << "RGB error mean " << stats.mean_error << ", max " << stats.max_error << ", "
+              << stats.above_tolerance << " entries above " << spectral_fit::TOLERANCE
+              << " (colours outside the reflectance gamut)" << std::endl;
+
+    int compare_count = result["compare"].as<int>();
+    if (compare_count > 0)
+        compare(table, step, compare_count);
+
+    return spectral_lut::save(std::vector<std::string>{result["output"].as<std::string>()}, table, step) ? 0 : 1;
+}
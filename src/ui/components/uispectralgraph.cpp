@@ -6,9 +6,9 @@
 UISpectralGraph::UISpectralGraph(QWidget *parent)
     : QWidget(parent), m_minValue(0), m_maxValue(1)
 {
-    m_spectralData.resize(31);
+    m_spectralData.resize(spectrum::RESPONSE_SAMPLES);
     setMinimumSize(300, 150);
-    observer_ptr = new observer(observer::CIE1931_2Deg, spectrum::RESPONSE_SAMPLES, spectrum::START_WAVELENGTH, spectrum::END_WAVELENGTH);
+    observer_ptr = observer::get(observer::CIE1931_2Deg);
     
     // Set the background color and make the widget transparent
     setAutoFillBackground(true);
@@ -22,7 +22,7 @@ QSize UISpectralGraph::sizeHint() const
 
 void UISpectralGraph::update_graph(const spectrum& color_spectrum)
 {
-    for (int i = 0; i < 31; ++i) {
+    for (int i = 0; i < spectrum::RESPONSE_SAMPLES; ++i) {
         m_spectralData[i] = color_spectrum[i];
     }
     color_rgb = color_spectrum.to_rgb(observer_ptr);
@@ -32,8 +32,8 @@ void UISpectralGraph::update_graph(const spectrum& color_spectrum)
 
 void UISpectralGraph::setSpectralData(const QVector<float>& data)
 {
-    if (data.size() != 31) {
-        qWarning() << "Spectral data must contain exactly 31 points";
+    if (data.size() != spectrum::RESPONSE_SAMPLES) {
+        qWarning() << "Spectral data must contain exactly" << spectrum::RESPONSE_SAMPLES << "points";
         return;
     }
     m_spectralData = data;
@@ -79,7 +79,7 @@ void UISpectralGraph::paintEvent(QPaintEvent *)
     if (!m_spectralData.isEmpty()) {
         QPainterPath path;
         for (int i = 0; i < m_spectralData.size(); ++i) {
-            float x = margin + (i / 30.0) * graphWidth;
+            float x = margin + (i / double(m_spectralData.size() - 1)) * graphWidth;
             float y = height() - 20 - ((m_spectralData[i] - m_minValue) / (m_maxValue - m_minValue)) * graphHeight;
             if (i == 0) {
                 path.moveTo(x, y);
@@ -97,7 +97,7 @@ void UISpectralGraph::paintEvent(QPaintEvent *)
     font.setPointSize(8);
     painter.setFont(font);
     for (int i = 0; i <= 3; ++i) {
-        int wavelength = 400 + i * 100;
+        int wavelength = int(spectrum::START_WAVELENGTH + i * (spectrum::END_WAVELENGTH - spectrum::START_WAVELENGTH) / 3.0f + 0.5f);
         float x = margin + (i / 3.0) * graphWidth;
         painter.drawText(QPointF(x - 15, height() - 20 + 15), QString::number(wavelength) + "nm");
     }
@@ -22,7 +22,7 @@ protected:
 
 private:
     QVector<float> m_spectralData;
-    observer* observer_ptr;
+    const observer* observer_ptr;
     float m_minValue;
     float m_maxValue;
     color color_rgb;
@@ -23,7 +23,7 @@ RenderWindow::RenderWindow(settings * settings_ptr, rd::usd::loader * loader, QW
 
     m_settings_ptr = settings_ptr;
     m_loader = loader;
-    observer_ptr = new observer(observer::CIE1931_2Deg, spectrum::RESPONSE_SAMPLES, spectrum::START_WAVELENGTH, spectrum::END_WAVELENGTH);
+    observer_ptr = observer::get(observer::CIE1931_2Deg);
     m_image_buffer = new ImageSPD(m_width, m_height, spectrum::RESPONSE_SAMPLES, observer_ptr);
     m_image = new QImage(m_width, m_height, QImage::Format_RGB888);
     m_image->fill(Qt::black);
@@ -82,7 +82,7 @@ void RenderWindow::setupUI()
     m_progressBar->setValue(0);
     m_progressBar->hide();
 
-    QStringList renderModeOptions = {"Full", "Fast"};
+    QStringList renderModeOptions = {"Full", "Fast", "ReSTIR"};
     m_render_mode = new UiDropdownMenu("Render Mode:", renderModeOptions, this);
     m_render_mode->setCurrentIndex(0);
     connect(m_render_mode, &UiDropdownMenu::index_changed, this, &RenderWindow::render_mode_changed);
@@ -268,16 +268,16 @@ void RenderWindow::updateSamples(int samples) {
 void RenderWindow::update_observer(int index) {   
     switch (index) {
         case 0:
-            observer_ptr = new observer(observer::CIE1931_2Deg, spectrum::RESPONSE_SAMPLES, spectrum::START_WAVELENGTH, spectrum::END_WAVELENGTH);
+            observer_ptr = observer::get(observer::CIE1931_2Deg);
             break;
         case 1:
-            observer_ptr = new observer(observer::CIE1964_10Deg, spectrum::RESPONSE_SAMPLES, spectrum::START_WAVELENGTH, spectrum::END_WAVELENGTH);
+            observer_ptr = observer::get(observer::CIE1964_10Deg);
             break;
         case 2:
-            observer_ptr = new observer(observer::CIE2006_2Deg, spectrum::RESPONSE_SAMPLES, spectrum::START_WAVELENGTH, spectrum::END_WAVELENGTH);
+            observer_ptr = observer::get(observer::CIE2006_2Deg);
             break;
         case 3:
-            observer_ptr = new observer(observer::CIE2006_10Deg, spectrum::RESPONSE_SAMPLES, spectrum::START_WAVELENGTH, spectrum::END_WAVELENGTH);
+            observer_ptr = observer::get(observer::CIE2006_10Deg);
             break;
     }
     need_to_update_image = true;
@@ -304,45 +304,29 @@ void RenderWindow::update_image() {
     double base_iso = 100.0;
 
     QImage updatedImage(m_width, m_height, QImage::Format_RGB888);
-    if(m_primaries->getCurrentIndex() == 0) {
-        for (int i = 0; i < m_image_buffer->width(); i++) {
-            for (int j = 0; j < m_image_buffer->height(); j++) {
-                spectrum color_spectrum = m_image_buffer->get_pixel(i, j) * (m_exposure / base_iso) * (1.0 / m_shutter) * 0.3;
-
-                color color_rgb_displayP3 = color_spectrum.to_XYZ(observer_ptr).to_rgbDisplayP3();
-                color_rgb_displayP3.adjustColorTemperature(m_whitebalance);
-                float r = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb_displayP3.x(), m_gamma))); 
-                float g = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb_displayP3.y(), m_gamma)));
-                float b = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb_displayP3.z(), m_gamma)));
-                if (m_region_x > -1){
-                    if (i < m_region_x || i >= m_region_x + m_region_width || j < m_region_y || j >= m_region_y + m_region_height) {
-                        r *= 0.5;
-                        g *= 0.5;
-                        b *= 0.5;
-                    }
-                }
-                updatedImage.setPixelColor(i, j, QColor::fromRgb(r, g, b));
-            }
-        }
-    } else {
+    const double scale = (m_exposure / base_iso) * (1.0 / m_shutter) * 0.3;
+    const bool display_p3 = m_primaries->getCurrentIndex() == 0;
+
+    // Whole scanlines go through the observer at once
+    std::vector<float> xyz_row(m_image_buffer->width() * 3);
+    for (int j = 0; j < m_image_buffer->height(); j++) {
+        m_image_buffer->get_row_XYZ(j, observer_ptr, xyz_row.data());
         for (int i = 0; i < m_image_buffer->width(); i++) {
-            for (int j = 0; j < m_image_buffer->height(); j++) {
-                spectrum color_spectrum = m_image_buffer->get_pixel(i, j) * (m_exposure / base_iso) * (1.0 / m_shutter) * 0.3;
-
-                color color_rgb = color_spectrum.to_rgb(observer_ptr);
-                color_rgb.adjustColorTemperature(m_whitebalance);
-                float r = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb.x(), m_gamma))); 
-                float g = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb.y(), m_gamma)));
-                float b = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb.z(), m_gamma)));
-                if (m_region_x > -1){
-                    if (i < m_region_x || i >= m_region_x + m_region_width || j < m_region_y || j >= m_region_y + m_region_height) {
-                        r *= 0.5;
-                        g *= 0.5;
-                        b *= 0.5;
-                    }
+            color xyz(xyz_row[i * 3 + 0] * scale, xyz_row[i * 3 + 1] * scale, xyz_row[i * 3 + 2] * scale, color::ColorSpace::XYZ);
+
+            color color_rgb = display_p3 ? xyz.to_rgbDisplayP3() : xyz.to_rgb();
+            color_rgb.adjustColorTemperature(m_whitebalance);
+            float r = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb.x(), m_gamma))); 
+            float g = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb.y(), m_gamma)));
+            float b = int(255.999 * intensity.clamp(linear_to_gamma2(color_rgb.z(), m_gamma)));
+            if (m_region_x > -1){
+                if (i < m_region_x || i >= m_region_x + m_region_width || j < m_region_y || j >= m_region_y + m_region_height) {
+                    r *= 0.5;
+                    g *= 0.5;
+                    b *= 0.5;
                 }
-                updatedImage.setPixelColor(i, j, QColor::fromRgb(r, g, b));
             }
+            updatedImage.setPixelColor(i, j, QColor::fromRgb(r, g, b));
         }
     }
     
@@ -89,7 +89,7 @@ private:
     QScrollArea *m_scrollArea;
     QMap<QString, QString> m_metadata;
     QProgressBar *m_progressBar;
-    observer * observer_ptr;
+    const observer * observer_ptr;
     ImageSPD * m_image_buffer;
     UiFloat *m_exposureInput;
     UiFloat *m_shutterInput;
@@ -52,6 +52,14 @@ namespace rd::usd::light {
             if(verbose > 0) std::cout << "Spectrum input not found" << std::endl;
         }
 
+        // Per light override of the sampling strategy, "area" or "solid_angle"
+        pxr::UsdAttribute samplingAttr = prim.GetAttribute(pxr::TfToken("inputs:sampling"));
+        if (samplingAttr) {
+            pxr::TfToken samplingToken;
+            if (samplingAttr.Get(&samplingToken)) light.sampling = samplingToken.GetString();
+            else samplingAttr.Get(&light.sampling);
+        }
+
         pxr::UsdAttribute verticesAttr = prim.GetAttribute(pxr::TfToken("primvars:arnold:vertices"));
         if (verticesAttr) {verticesAttr.Get(&light.vertices);
             for(auto& v : light.vertices) {
@@ -88,7 +96,7 @@ namespace rd::usd::light {
         
         return light;
     }
-    std::vector<rd::core::area_light*> extractAreaLightsFromUsdStage(const pxr::UsdStageRefPtr& stage, observer * observer) {
+    std::vector<rd::core::area_light*> extractAreaLightsFromUsdStage(const pxr::UsdStageRefPtr& stage, const observer * observer, const std::string& default_sampling) {
         std::vector<AreaLight> areaLightsDescriptors;
         std::vector<rd::core::area_light*> area_lights;
         
@@ -102,30 +110,31 @@ namespace rd::usd::light {
         }
         for(const auto& light : areaLightsDescriptors) {
             double light_intensity = light.intensity;
+            auto sampling = rd::core::area_light::sampling_from_string(light.sampling != "" ? light.sampling : default_sampling);
             if (light.textureFilePath != "") {
                 std::cout << "Loading texture: " << light.textureFilePath << std::endl;
                 auto texture_ptr = new ImageSPD(ImageSPD::load(light.textureFilePath.c_str(), observer));
 
                 if(light.spectrumValues.size() > 0) {
                     auto light_material = new rd::core::light(spectrum(light.spectrumValues.data()), light_intensity, texture_ptr, light.spread);
-                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material);
+                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material, sampling);
                     area_lights.push_back(light_quad);
                 }
                 else {
                     auto light_material = new rd::core::light(spectrum::d65(), light_intensity, texture_ptr, light.spread);
-                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material);
+                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material, sampling);
                     area_lights.push_back(light_quad);
                 }
             }
             else {
                 if(light.spectrumValues.size() > 0) {
                     auto light_material = new rd::core::light(spectrum(light.spectrumValues.data()), light_intensity, nullptr, light.spread);
-                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material);
+                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material, sampling);
                     area_lights.push_back(light_quad);
                 }
                 else {
                     auto light_material = new rd::core::light(spectrum::d65(), light_intensity, nullptr, light.spread);
-                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material);
+                    auto light_quad = new rd::core::area_light(light.Q, light.u, light.v, light_material, sampling);
                     area_lights.push_back(light_quad);
                 }
             }
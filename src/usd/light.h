@@ -33,12 +33,13 @@ namespace rd::usd::light {
         pxr::GfVec3d scale;
         pxr::GfVec3d translation;
         pxr::VtArray<float> spectrumValues;
+        std::string sampling;
         point3 Q;
         vec3 u;
         vec3 v;
     };
     extern AreaLight extractAreaLightProperties(const pxr::UsdPrim& prim, const pxr::GfMatrix4d& transform, int verbose = 0);
-    extern std::vector<rd::core::area_light*> extractAreaLightsFromUsdStage(const pxr::UsdStageRefPtr& stage, observer * observer) ;
+    extern std::vector<rd::core::area_light*> extractAreaLightsFromUsdStage(const pxr::UsdStageRefPtr& stage, const observer * observer, const std::string& default_sampling = "area") ;
 }
 
 #endif
\ No newline at end of file
@@ -195,7 +195,7 @@ namespace rd::usd::material {
             color emissionColor(emission_color[0], emission_color[1], emission_color[2]);
             rd::core::advanced_pbr_material* mat = new rd::core::advanced_pbr_material(
                 base_weight, 
-                hasSpectral ? spectrum(spectrumValues.data()) : diffuseColor , 
+                hasSpectral ? spectrum(spectrumValues.data()) : spectral_net::uplift(diffuseColor) , 
                 metalness, 
                 specular, color(1,1,1), specular_roughness, 1.5,
                 transmission, color(1,1,1), 
@@ -8,6 +8,7 @@
 #include "../data/hittable.h"
 #include "../data/hittable_list.h"
 #include "../data/bvh.h"
+#include "../data/spectral_net.h"
 
 #include <pxr/usd/usd/stage.h>
 #include <pxr/usd/usd/primRange.h>